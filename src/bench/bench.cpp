@@ -0,0 +1,471 @@
+#include "core/PPMImage.hh"
+#include "core/batchLoader.hh"
+#include "core/resampler.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+
+#include <zlib.h>
+#ifdef PPM_HAS_ZSTD
+#include <zstd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+//------------------------------------------------------------------------------
+// Synthetic image, so the benchmark does not depend on files lying around
+ImageData makeImage(uint32_t width, uint32_t height, uint32_t maxColorValue)
+{
+    ImageData data;
+    data.imageWidth = width;
+    data.imageHeight = height;
+    data.maxColorValue = maxColorValue;
+    data.pixelData.resize(static_cast<size_t>(width) * height * 3);
+
+    uint32_t seed = 0x9e3779b9;
+    for (size_t it = 0; it < data.pixelData.size(); it++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        data.pixelData[it] = static_cast<uint16_t>((seed >> 8) % (maxColorValue + 1));
+    }
+
+    return data;
+}
+
+double timeIt(const std::function<void()>& func)
+{
+    auto start = std::chrono::steady_clock::now();
+    func();
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double>(end - start).count();
+}
+
+void report(const std::string& name, double seconds, uintmax_t bytes,
+            const ImageData& data)
+{
+    double megapixels = static_cast<double>(data.imageWidth) * data.imageHeight / 1e6;
+
+    std::cout << std::left << std::setw(28) << name << std::right << std::fixed
+              << std::setprecision(3) << std::setw(9) << seconds << " s"
+              << std::setprecision(1) << std::setw(10) << bytes / seconds / 1e6 << " MB/s"
+              << std::setw(10) << megapixels / seconds << " MP/s\n";
+}
+
+//------------------------------------------------------------------------------
+// Encodes and decodes the same image in every format and depth
+int roundTrip(const fs::path& dir, uint32_t width, uint32_t height)
+{
+    int failures = 0;
+
+    for (uint32_t maxColorValue : {255u, 65535u})
+    {
+        ImageData image = makeImage(width, height, maxColorValue);
+        std::string depth = maxColorValue <= 255 ? "8-bit" : "16-bit";
+
+        for (PPMType type : {PPMType::P6, PPMType::P3})
+        {
+            std::string format = type == PPMType::P6 ? "P6" : "P3";
+            std::string fileName = (dir / (format + "_" + depth + ".ppm")).string();
+
+            double writeTime = timeIt([&]() { writeImageData(fileName, image, type); });
+            if (!image.isValid())
+            {
+                std::cerr << "Error: " << image.exceptionMsg << '\n';
+                return 1;
+            }
+            uintmax_t fileSize = fs::file_size(fileName);
+
+            ImageData decoded;
+            double readTime = timeIt([&]() { getImageData(fileName, decoded); });
+
+            report(format + " " + depth + " write", writeTime, fileSize, image);
+            report(format + " " + depth + " read", readTime, fileSize, image);
+
+            if (!decoded.isValid() || decoded.pixelData != image.pixelData)
+            {
+                std::cerr << "Round trip mismatch for " << fileName << '\n';
+                failures++;
+            }
+
+            // The first P3 decode left a row index behind
+            if (type == PPMType::P3 && fs::exists(fileName + ".idx"))
+            {
+                ImageData indexed;
+                double indexedTime = timeIt([&]() { getImageData(fileName, indexed); });
+                report(format + " " + depth + " read (index)", indexedTime, fileSize, image);
+
+                if (!indexed.isValid() || indexed.pixelData != image.pixelData)
+                {
+                    std::cerr << "Indexed decode mismatch for " << fileName << '\n';
+                    failures++;
+                }
+            }
+        }
+    }
+
+    return failures;
+}
+
+// Compares decoding a crop against decoding the whole image
+int regionDecode(const fs::path& dir, uint32_t width, uint32_t height)
+{
+    int failures = 0;
+    const uint32_t regionWidth = std::min(512u, width);
+    const uint32_t regionHeight = std::min(512u, height);
+    const uint32_t x = (width - regionWidth) / 2;
+    const uint32_t y = (height - regionHeight) / 2;
+
+    for (PPMType type : {PPMType::P6, PPMType::P3})
+    {
+        ImageData image = makeImage(width, height, 255);
+        std::string format = type == PPMType::P6 ? "P6" : "P3";
+        std::string fileName = (dir / ("region_" + format + ".ppm")).string();
+        writeImageData(fileName, image, type);
+
+        ImageData full;
+        double fullTime = timeIt([&]() { getImageData(fileName, full); });
+
+        ImageData region;
+        double regionTime = timeIt([&]()
+        {
+            getImageRegion(fileName, x, y, regionWidth, regionHeight, region);
+        });
+
+        std::cout << format << " " << regionWidth << "x" << regionHeight
+                  << " region: " << std::fixed << std::setprecision(4)
+                  << regionTime << " s, full decode: " << fullTime << " s\n";
+
+        bool matches = region.isValid() && region.imageWidth == regionWidth
+                       && region.imageHeight == regionHeight;
+        for (uint32_t row = 0; matches && row < regionHeight; row++)
+        {
+            auto expected = image.pixelData.begin()
+                            + ((static_cast<size_t>(y) + row) * width + x) * 3;
+            matches = std::equal(expected, expected + regionWidth * 3,
+                                 region.pixelData.begin() + row * regionWidth * 3);
+        }
+
+        if (!matches)
+        {
+            std::cerr << "Region mismatch for " << fileName << '\n';
+            failures++;
+        }
+    }
+
+    return failures;
+}
+
+// Shrinks the image to a quarter of its size with every filter
+int resample(uint32_t width, uint32_t height)
+{
+    const std::pair<ResampleFilter, std::string> filters[] =
+    {
+        {ResampleFilter::Box, "box"},
+        {ResampleFilter::Mitchell, "mitchell"},
+        {ResampleFilter::Lanczos3, "lanczos3"}
+    };
+
+    int failures = 0;
+    for (uint32_t maxColorValue : {255u, 65535u})
+    {
+        ImageData image = makeImage(width, height, maxColorValue);
+        std::string depth = maxColorValue <= 255 ? "8-bit" : "16-bit";
+
+        for (const auto& [filter, name] : filters)
+        {
+            ImageData resampled;
+            double seconds = timeIt([&]()
+            {
+                resampleImage(image, std::max(1u, width / 4), std::max(1u, height / 4),
+                              filter, resampled);
+            });
+
+            // Throughput is measured in source pixels
+            report("resample " + name + " " + depth, seconds,
+                   image.pixelData.size() * (maxColorValue <= 255 ? 1 : 2), image);
+
+            if (!resampled.isValid())
+            {
+                std::cerr << "Error: " << resampled.exceptionMsg << '\n';
+                failures++;
+            }
+        }
+    }
+
+    return failures;
+}
+
+// Loads a folder of smaller frames one by one and as a batch
+int batchLoad(const fs::path& dir, uint32_t width, uint32_t height)
+{
+    constexpr int fileCount = 32;
+    const uint32_t frameWidth = std::max(1u, width / 4);
+    const uint32_t frameHeight = std::max(1u, height / 4);
+
+    std::vector<std::string> paths;
+    std::vector<ImageData> frames;
+    uintmax_t totalSize = 0;
+    for (int it = 0; it < fileCount; it++)
+    {
+        // Every third frame is P3 so both decoders are involved
+        PPMType type = it % 3 == 2 ? PPMType::P3 : PPMType::P6;
+        frames.push_back(makeImage(frameWidth, frameHeight, it % 2 ? 65535 : 255));
+        paths.push_back((dir / ("frame_" + std::to_string(it) + ".ppm")).string());
+        writeImageData(paths.back(), frames.back(), type);
+        totalSize += fs::file_size(paths.back());
+    }
+
+    ImageData all;
+    all.imageWidth = frameWidth;
+    all.imageHeight = frameHeight * fileCount;
+
+    std::vector<ImageData> sequential(fileCount);
+    double sequentialTime = timeIt([&]()
+    {
+        for (int it = 0; it < fileCount; it++)
+            getImageData(paths[it], sequential[it]);
+    });
+    report("load 32 files one by one", sequentialTime, totalSize, all);
+
+    std::vector<ImageData> batched;
+    double batchTime = timeIt([&]() { batched = loadImages(paths); });
+    report("load 32 files batched", batchTime, totalSize, all);
+
+    int failures = 0;
+    for (int it = 0; it < fileCount; it++)
+    {
+        if (!batched[it].isValid() || batched[it].pixelData != frames[it].pixelData)
+        {
+            std::cerr << "Batch load mismatch for " << paths[it] << '\n';
+            failures++;
+        }
+    }
+
+    // Files that end right after the header have to fail, not be read past
+    std::vector<std::string> truncated;
+    for (std::string format : {"P3", "P6"})
+    {
+        truncated.push_back((dir / ("truncated_" + format + ".ppm")).string());
+        std::ofstream(truncated.back(), std::ios::binary) << format << "\n1 1\n255";
+    }
+
+    for (const ImageData& result : loadImages(truncated))
+    {
+        if (result.isValid())
+        {
+            std::cerr << "Batch load accepted a truncated file\n";
+            failures++;
+        }
+    }
+
+    return failures;
+}
+
+// Decodes the same P3 image with an empty and a warm pixel cache
+int pixelCache(const fs::path& dir, uint32_t width, uint32_t height)
+{
+    ::unsetenv("PPM_VIEWER_CACHE_SIZE");
+
+    int failures = 0;
+    for (uint32_t maxColorValue : {255u, 65535u})
+    {
+        ImageData image = makeImage(width, height, maxColorValue);
+        std::string depth = maxColorValue <= 255 ? "8-bit" : "16-bit";
+        std::string fileName = (dir / ("cache_" + depth + ".ppm")).string();
+        writeImageData(fileName, image, PPMType::P3);
+        uintmax_t fileSize = fs::file_size(fileName);
+
+        for (std::string pass : {"cold", "cached"})
+        {
+            ImageData decoded;
+            double seconds = timeIt([&]() { getImageData(fileName, decoded); });
+            report("P3 " + depth + " read (" + pass + ")", seconds, fileSize, image);
+
+            if (!decoded.isValid() || decoded.pixelData != image.pixelData)
+            {
+                std::cerr << "Cached decode mismatch for " << fileName << '\n';
+                failures++;
+            }
+        }
+    }
+
+    // Later sections measure the decoders on their own again
+    ::setenv("PPM_VIEWER_CACHE_SIZE", "0", 1);
+
+    return failures;
+}
+
+// Compresses the file with gzip -6, false on error
+bool gzipFile(const std::string& fileName, const std::string& gzipName)
+{
+    std::ifstream input(fileName, std::ios::binary);
+    gzFile output = gzopen(gzipName.c_str(), "wb6");
+    if (!input || !output) return false;
+
+    std::vector<char> buffer(1024 * 1024);
+    while (input.read(buffer.data(), buffer.size()) || input.gcount() > 0)
+    {
+        if (gzwrite(output, buffer.data(), input.gcount()) != input.gcount())
+        {
+            gzclose(output);
+            return false;
+        }
+    }
+
+    return gzclose(output) == Z_OK;
+}
+
+#ifdef PPM_HAS_ZSTD
+// Compresses the file with zstd -3, false on error
+bool zstdFile(const std::string& fileName, const std::string& zstdName)
+{
+    std::ifstream input(fileName, std::ios::binary);
+    std::ofstream output(zstdName, std::ios::binary);
+    ZSTD_CCtx* context = ZSTD_createCCtx();
+    if (!input || !output || !context)
+    {
+        ZSTD_freeCCtx(context);
+        return false;
+    }
+    ZSTD_CCtx_setParameter(context, ZSTD_c_compressionLevel, 3);
+
+    std::vector<char> buffer(1024 * 1024);
+    std::vector<char> compressed(ZSTD_CStreamOutSize());
+    bool success = true;
+    bool finished = false;
+    while (success && !finished)
+    {
+        input.read(buffer.data(), buffer.size());
+        finished = !input;
+        ZSTD_EndDirective mode = finished ? ZSTD_e_end : ZSTD_e_continue;
+        ZSTD_inBuffer in = {buffer.data(), static_cast<size_t>(input.gcount()), 0};
+
+        // Flush until the chunk is consumed, or the frame is complete at the end
+        bool flushed = false;
+        while (success && !flushed)
+        {
+            ZSTD_outBuffer out = {compressed.data(), compressed.size(), 0};
+            size_t remaining = ZSTD_compressStream2(context, &out, &in, mode);
+            success = !ZSTD_isError(remaining) && output.write(compressed.data(), out.pos);
+            flushed = finished ? remaining == 0 : in.pos == in.size;
+        }
+    }
+
+    ZSTD_freeCCtx(context);
+    output.close();
+    return success && output;
+}
+#endif
+
+// Decodes the same image from a plain and a gzip compressed file, and a zstd
+// one when built with zstd. The image is a noisy gradient that gzip shrinks
+// about 10x, like archived frames
+int compressed(const fs::path& dir, uint32_t width, uint32_t height)
+{
+    int failures = 0;
+    for (PPMType type : {PPMType::P6, PPMType::P3})
+    {
+        ImageData image = makeImage(width, height, 255);
+        for (uint32_t y = 0; y < height; y++)
+        {
+            for (size_t x = 0; x < static_cast<size_t>(width) * 3; x++)
+            {
+                uint16_t& sample = image.pixelData[y * static_cast<size_t>(width) * 3 + x];
+                sample = ((x / 3 + y) / 16 + sample % 4) % 256;
+            }
+        }
+
+        std::string format = type == PPMType::P6 ? "P6" : "P3";
+        std::string fileName = (dir / ("compressed_" + format + ".ppm")).string();
+        writeImageData(fileName, image, type);
+        bool compressedAll = gzipFile(fileName, fileName + ".gz");
+        // Suffix and name of each file decoded
+        std::vector<std::pair<std::string, std::string>> variants = {{"", ""},
+                                                                     {".gz", "gzip"}};
+#ifdef PPM_HAS_ZSTD
+        compressedAll = compressedAll && zstdFile(fileName, fileName + ".zst");
+        variants.push_back({".zst", "zstd"});
+#endif
+        if (!compressedAll)
+        {
+            std::cerr << "Could not compress " << fileName << '\n';
+            failures++;
+            continue;
+        }
+
+        // Throughput is measured in uncompressed bytes for all of them
+        uintmax_t fileSize = fs::file_size(fileName);
+        for (const auto& [suffix, name] : variants)
+        {
+            if (suffix.empty()) continue;
+            std::cout << format << " compression ratio (" << name << "): " << std::fixed
+                      << std::setprecision(1)
+                      << static_cast<double>(fileSize) / fs::file_size(fileName + suffix)
+                      << '\n';
+        }
+
+        for (const auto& [suffix, name] : variants)
+        {
+            ImageData decoded;
+            double seconds = timeIt([&]() { getImageData(fileName + suffix, decoded); });
+            report(format + " 8-bit read" + (name.empty() ? "" : " (" + name + ")"),
+                   seconds, fileSize, image);
+
+            if (!decoded.isValid() || decoded.pixelData != image.pixelData)
+            {
+                std::cerr << "Compressed decode mismatch for " << fileName + suffix << '\n';
+                failures++;
+            }
+        }
+    }
+
+    return failures;
+}
+
+// Usage: ppm-bench [width height]
+int main(int argc, char** argv)
+{
+    uint32_t width = 4096;
+    uint32_t height = 4096;
+    if (argc == 3)
+    {
+        width = std::stoul(argv[1]);
+        height = std::stoul(argv[2]);
+    }
+
+    fs::path dir = fs::temp_directory_path() / "ppm-bench";
+    fs::create_directories(dir);
+
+    // Keep the user's cache out of it, and measure the decoders themselves
+    // until the cache gets its own section
+    ::setenv("XDG_CACHE_HOME", (dir / "cache").c_str(), 1);
+    ::setenv("PPM_VIEWER_CACHE_SIZE", "0", 1);
+
+    std::cout << "Image: " << width << "x" << height << "\n\n";
+    int failures = roundTrip(dir, width, height);
+    std::cout << '\n';
+    failures += regionDecode(dir, width, height);
+    std::cout << '\n';
+    failures += resample(width, height);
+    std::cout << '\n';
+    failures += batchLoad(dir, width, height);
+    std::cout << '\n';
+    failures += pixelCache(dir, width, height);
+    std::cout << '\n';
+    failures += compressed(dir, width, height);
+
+    fs::remove_all(dir);
+
+    return failures == 0 ? 0 : 1;
+}
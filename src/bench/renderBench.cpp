@@ -0,0 +1,128 @@
+#include "core/PPMImage.hh"
+#include "core/renderer.hh"
+
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace fs = std::filesystem;
+
+//------------------------------------------------------------------------------
+// Gradient test image, used when no file is given
+ImageData makeImage(uint32_t width, uint32_t height)
+{
+    ImageData data;
+    data.imageWidth = width;
+    data.imageHeight = height;
+    data.maxColorValue = 255;
+    data.pixelData.resize(static_cast<size_t>(width) * height * 3);
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+        for (uint32_t x = 0; x < width; x++)
+        {
+            uint16_t* pixel = data.pixelData.data() + (static_cast<size_t>(y) * width + x) * 3;
+            pixel[0] = static_cast<uint16_t>(x * 255 / width);
+            pixel[1] = static_cast<uint16_t>(y * 255 / height);
+            pixel[2] = static_cast<uint16_t>((x ^ y) & 0xff);
+        }
+    }
+
+    return data;
+}
+
+// The texture is sampled 1:1, so only 16-bit images may be off by rounding
+size_t countMismatches(const ImageData& data, const std::vector<uint8_t>& pixels)
+{
+    size_t mismatches = 0;
+    for (size_t it = 0; it < data.pixelData.size(); it++)
+    {
+        int expected = data.maxColorValue <= 255
+                       ? data.pixelData[it]
+                       : (data.pixelData[it] * 255 + 32767) / 65535;
+        if (std::abs(expected - pixels[it]) > 1)
+            mismatches++;
+    }
+
+    return mismatches;
+}
+
+void report(const std::string& name, double seconds)
+{
+    std::cout << std::left << std::setw(12) << name << std::right << std::fixed
+              << std::setprecision(3) << std::setw(10) << seconds * 1000.0 << " ms\n";
+}
+
+// Usage: ppm-bench-render [image.ppm] [frames]
+int main(int argc, char** argv)
+{
+    uint32_t frameCount = 100;
+    std::string fileName;
+    bool generated = argc < 2;
+
+    if (generated)
+    {
+        fileName = (fs::temp_directory_path() / "ppm-bench-render.ppm").string();
+        ImageData image = makeImage(2048, 2048);
+        writeImageData(fileName, image, PPMType::P6);
+        if (!image.isValid())
+        {
+            std::cerr << "Error: " << image.exceptionMsg << '\n';
+            return 1;
+        }
+    }
+    else
+    {
+        fileName = argv[1];
+    }
+
+    if (argc == 3)
+    {
+        frameCount = std::stoul(argv[2]);
+    }
+
+    ImageData data;
+    auto start = std::chrono::steady_clock::now();
+    getImageData(fileName, data);
+    auto end = std::chrono::steady_clock::now();
+
+    if (generated)
+        fs::remove(fileName);
+
+    if (!data.isValid())
+    {
+        std::cerr << "Error: " << data.exceptionMsg << '\n';
+        return 1;
+    }
+
+    Renderer renderer(data);
+    RenderStats stats;
+    std::vector<uint8_t> pixels;
+    if (!renderer.runHeadless(frameCount, stats, pixels))
+    {
+        return 1;
+    }
+
+    std::cout << "Image: " << data.imageWidth << "x" << data.imageHeight
+              << ", " << frameCount << " frames\n\n";
+    report("decode", std::chrono::duration<double>(end - start).count());
+    report("upload", stats.uploadTime);
+    report("mipmap", stats.mipmapTime);
+    report("frame", stats.frameTime);
+
+    size_t mismatches = countMismatches(data, pixels);
+    if (mismatches > 0)
+    {
+        std::cerr << mismatches << " of " << pixels.size()
+                  << " read back samples differ from the image\n";
+        return 1;
+    }
+
+    std::cout << "\nRead back matches the image\n";
+    return 0;
+}
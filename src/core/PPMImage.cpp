@@ -1,30 +1,178 @@
 #include "PPMImage.hh"
+#include "PPMIndex.hh"
+#include "pixelCache.hh"
+#include "decompressor.hh"
 
 #include <fstream>
 #include <ios>
 #include <iostream>
 #include <sstream>
+#include <streambuf>
+#include <string_view>
 #include <vector>
+#include <deque>
+#include <future>
+#include <thread>
+#include <charconv>
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstring>
 #include <cstdint>
 
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 constexpr char s_commentChar = '#';
+// What std::isspace() accepts in the C locale, and with the comment char
+// everything that ends a P3 token
+constexpr std::string_view s_whitespace = " \t\n\v\f\r";
+constexpr std::string_view s_P3Separators = " \t\n\v\f\r#";
 const std::string s_PPMextension = ".ppm";
 
-enum class PPMType
-{
-    None = 0,
-    P3,
-    P6
-};
+// P3 payloads smaller than this parse fast enough without a row index
+constexpr size_t s_rowIndexMinSize = 4 * 1024 * 1024;
+// or without the pixel cache
+constexpr size_t s_P3CacheMinSize = 4 * 1024 * 1024;
+// Rows formatted per task when writing P3
+constexpr uint32_t s_P3BandRows = 64;
+// Plain PPM lines should not be longer than 70 characters
+constexpr size_t s_P3LineLength = 70;
 
 //------------------------------------------------------------------------------
-void parseP3Data(std::istream& f, ImageData& data);
+class ChunkBuffer;
+
+void parseCompressedData(Decompressor& source, ImageData& data);
+void parseP3Data(std::istream& f, ImageData& data, const std::string& fileName,
+                 bool storeInCache = false);
+void parseP3Payload(std::string_view content, std::streamoff dataStart,
+                    ImageData& data, const std::string& fileName,
+                    bool storeInCache = false);
+void parseP3Serial(std::string_view content, std::streamoff dataStart,
+                   ImageData& data, RowIndex* index);
+bool parseP3Indexed(std::string_view content, std::streamoff dataStart,
+                    const RowIndex& index, ImageData& data);
+bool parseP3Region(std::istream& f, const RowIndex& index,
+                   uint32_t y, uint32_t height, ImageData& data);
+bool parseP3Samples(const char*& ptr, const char* end, size_t sampleCount,
+                    uint32_t maxColorValue, uint16_t* dst);
+const char* skipP3Separators(const char* ptr, const char* end);
 void parseP6Data(std::istream& f, ImageData& data);
+void parseP6Payload(std::string_view payload, ImageData& data);
+void parseP6Region(std::istream& f, uint32_t x, uint32_t y,
+                   uint32_t width, uint32_t height, ImageData& data);
+void convertP6Samples(const uint8_t* src, size_t sampleCount,
+                      uint32_t maxColorValue, uint16_t* dst);
+void parseP6Thumbnail(std::istream& f, uint32_t width, uint32_t height,
+                      ImageData& data);
+void parseP3Stream(ChunkBuffer& chunks, ImageData& data);
+void parseP6Stream(ChunkBuffer& chunks, ImageData& data);
+void cropImage(uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+               ImageData& data);
+void sampleImage(uint32_t width, uint32_t height, ImageData& data);
 
 // Helpers
-bool hasPPMextension(const std::string& fileName);
 PPMType parseHeader(std::istream& f, ImageData& data);
+bool checkRegion(uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+                 ImageData& data);
+void getThumbnailSize(const ImageData& data, uint32_t maxSize,
+                      uint32_t& width, uint32_t& height);
 bool getToken(std::istream& f, std::string& token);
+std::string readRemaining(std::istream& f);
+
+inline size_t bytesPerSample(uint32_t maxColorValue)
+{
+    return maxColorValue <= 255 ? 1 : 2;
+}
+
+// Writers
+void writeP3Data(int fd, std::string& header, ImageData& data);
+void writeP6Data(int fd, std::string& header, ImageData& data);
+std::string formatP3Band(const ImageData& data, uint32_t firstRow, uint32_t rowCount);
+bool writeAll(int fd, iovec* iov, int iovCount);
+void packSamples8(const uint16_t* src, size_t count, uint8_t* dst);
+void swapSamples16(const uint16_t* src, size_t count, uint16_t* dst);
+
+//------------------------------------------------------------------------------
+// Lets the stream based header parser read from memory
+class MemoryBuffer : public std::streambuf
+{
+public:
+    MemoryBuffer(const char* buffer, size_t size)
+    {
+        char* begin = const_cast<char*>(buffer);
+        setg(begin, begin, begin + size);
+    }
+
+protected:
+    pos_type seekoff(off_type offset, std::ios_base::seekdir dir,
+                     std::ios_base::openmode which) override
+    {
+        if (!(which & std::ios_base::in)) return pos_type(off_type(-1));
+
+        char* base = dir == std::ios_base::beg ? eback()
+                   : dir == std::ios_base::cur ? gptr()
+                   : egptr();
+        if (offset < eback() - base || offset > egptr() - base)
+            return pos_type(off_type(-1));
+
+        setg(eback(), base + offset, egptr());
+        return pos_type(gptr() - eback());
+    }
+
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override
+    {
+        return seekoff(off_type(pos), std::ios_base::beg, which);
+    }
+};
+
+//------------------------------------------------------------------------------
+// Lets the header parser read from a Decompressor, the payload decoders take
+// the data a span at a time after that
+class ChunkBuffer : public std::streambuf
+{
+public:
+    explicit ChunkBuffer(Decompressor& source)
+        : m_source(source)
+    {
+    }
+
+    // The rest of the current chunk, then whole chunks. A span is only valid
+    // until the next call
+    bool nextSpan(std::string_view& span)
+    {
+        if (gptr() == egptr() && underflow() == traits_type::eof()) return false;
+
+        span = std::string_view(gptr(), egptr() - gptr());
+        setg(eback(), egptr(), egptr());
+        return true;
+    }
+
+protected:
+    int_type underflow() override
+    {
+        if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+
+        while (m_source.next(m_chunk))
+        {
+            if (m_chunk.empty()) continue;
+
+            setg(m_chunk.data(), m_chunk.data(), m_chunk.data() + m_chunk.size());
+            return traits_type::to_int_type(*gptr());
+        }
+
+        return traits_type::eof();
+    }
+
+private:
+    Decompressor& m_source;
+    std::string m_chunk;
+};
 
 //------------------------------------------------------------------------------
 template <typename T>
@@ -53,6 +201,14 @@ void getImageData(const std::string& fileName, ImageData& data)
         return;
     }
 
+    Compression compression = getCompression(fileName);
+    if (compression != Compression::None)
+    {
+        Decompressor source(fileName, compression);
+        parseCompressedData(source, data);
+        return;
+    }
+
     std::ifstream fileObj(fileName, std::ios::in | std::ios::binary);
     if (!fileObj)
     {
@@ -65,7 +221,7 @@ void getImageData(const std::string& fileName, ImageData& data)
     switch (type)
     {
         case PPMType::P3:
-            parseP3Data(fileObj, data);
+            parseP3Data(fileObj, data, fileName, true);
             break;
 
         case PPMType::P6:
@@ -79,13 +235,226 @@ void getImageData(const std::string& fileName, ImageData& data)
     fileObj.close();
 }
 
+//------------------------------------------------------------------------------
+void decodeImageBuffer(const std::string& fileName, const char* buffer,
+                       size_t size, ImageData& data)
+{
+    Compression compression = getCompression(fileName);
+    if (compression != Compression::None)
+    {
+        Decompressor source(buffer, size, compression);
+        parseCompressedData(source, data);
+        return;
+    }
+
+    MemoryBuffer memory(buffer, size);
+    std::istream stream(&memory);
+
+    PPMType type = parseHeader(stream, data);
+    if (type == PPMType::None) return;
+
+    // A header that ends at the end of the buffer leaves the stream failed,
+    // tellg() is -1 then
+    const std::streamoff dataStart = stream.tellg();
+    if (dataStart < 0 || static_cast<size_t>(dataStart) > size)
+    {
+        data.exceptionMsg = "Pixel data invalid or corrupted";
+        return;
+    }
+
+    std::string_view payload(buffer + dataStart, size - dataStart);
+
+    switch (type)
+    {
+        case PPMType::P3:
+            parseP3Payload(payload, dataStart, data, fileName);
+            break;
+
+        case PPMType::P6:
+            parseP6Payload(payload, data);
+            break;
+
+        case PPMType::None:
+            break;
+    }
+}
+
+//------------------------------------------------------------------------------
+void getImageRegion(const std::string& fileName, uint32_t x, uint32_t y,
+                    uint32_t width, uint32_t height, ImageData& data)
+{
+    if (!hasPPMextension(fileName))
+    {
+        data.exceptionMsg = "Invalid file: " + fileName;
+        return;
+    }
+
+    // Compressed files can't be seeked in, the whole image is decoded
+    if (getCompression(fileName) != Compression::None)
+    {
+        getImageData(fileName, data);
+        if (data.isValid() && checkRegion(x, y, width, height, data))
+            cropImage(x, y, width, height, data);
+        return;
+    }
+
+    std::ifstream fileObj(fileName, std::ios::in | std::ios::binary);
+    if (!fileObj)
+    {
+        data.exceptionMsg = fileName + " could not be opened!";
+        return;
+    }
+
+    PPMType type = parseHeader(fileObj, data);
+    if (type == PPMType::None) return;
+
+    if (!checkRegion(x, y, width, height, data)) return;
+
+    switch (type)
+    {
+        case PPMType::P3:
+        {
+            // Without an index the rows can't be located without parsing
+            // everything before them. The full decode builds the index
+            // for the next time.
+            std::streamoff dataStart = fileObj.tellg();
+            RowIndex index;
+            if (loadRowIndex(fileName, data.imageHeight, index)
+                && parseP3Region(fileObj, index, y, height, data))
+            {
+                cropImage(x, 0, width, height, data);
+                break;
+            }
+
+            fileObj.clear();
+            fileObj.seekg(dataStart);
+            parseP3Data(fileObj, data, fileName);
+            if (data.isValid())
+                cropImage(x, y, width, height, data);
+            break;
+        }
+
+        case PPMType::P6:
+            parseP6Region(fileObj, x, y, width, height, data);
+            break;
+
+        case PPMType::None:
+            break;
+    }
+
+    fileObj.close();
+}
+
+//------------------------------------------------------------------------------
+void getImageThumbnail(const std::string& fileName, uint32_t maxSize,
+                       ImageData& data)
+{
+    if (!hasPPMextension(fileName))
+    {
+        data.exceptionMsg = "Invalid file: " + fileName;
+        return;
+    }
+
+    uint32_t width;
+    uint32_t height;
+
+    // Compressed files can't be seeked in, the whole image is decoded
+    if (getCompression(fileName) != Compression::None)
+    {
+        getImageData(fileName, data);
+        if (data.isValid())
+        {
+            getThumbnailSize(data, maxSize, width, height);
+            sampleImage(width, height, data);
+        }
+        return;
+    }
+
+    std::ifstream fileObj(fileName, std::ios::in | std::ios::binary);
+    if (!fileObj)
+    {
+        data.exceptionMsg = fileName + " could not be opened!";
+        return;
+    }
+
+    PPMType type = parseHeader(fileObj, data);
+    if (type == PPMType::None) return;
+
+    getThumbnailSize(data, maxSize, width, height);
+
+    switch (type)
+    {
+        case PPMType::P3:
+            // Every token has to be parsed anyway, the row index at least
+            // lets this run in parallel
+            parseP3Data(fileObj, data, fileName);
+            if (data.isValid())
+                sampleImage(width, height, data);
+            break;
+
+        case PPMType::P6:
+            parseP6Thumbnail(fileObj, width, height, data);
+            break;
+
+        case PPMType::None:
+            break;
+    }
+
+    fileObj.close();
+}
+
+//------------------------------------------------------------------------------
+void writeImageData(const std::string& fileName, ImageData& data, PPMType type)
+{
+    if (type == PPMType::None)
+    {
+        data.exceptionMsg = "No PPM type given for " + fileName;
+        return;
+    }
+
+    size_t sampleCount = static_cast<size_t>(data.imageWidth) * data.imageHeight * 3;
+    if (sampleCount == 0 || data.pixelData.size() != sampleCount)
+    {
+        data.exceptionMsg = "Pixel data does not match the image dimensions";
+        return;
+    }
+
+    int fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        data.exceptionMsg = fileName + " could not be opened for writing!";
+        return;
+    }
+
+    // The decoder already scaled the samples to the full 8 or 16-bit range
+    uint32_t maxColorValue = data.maxColorValue <= 255 ? 255 : 65535;
+    std::string header = (type == PPMType::P3 ? "P3\n" : "P6\n")
+                         + std::to_string(data.imageWidth) + " "
+                         + std::to_string(data.imageHeight) + "\n"
+                         + std::to_string(maxColorValue) + "\n";
+
+    if (type == PPMType::P3)
+        writeP3Data(fd, header, data);
+    else
+        writeP6Data(fd, header, data);
+
+    if (::close(fd) != 0 && data.isValid())
+    {
+        data.exceptionMsg = "Error: could not finish writing " + fileName;
+    }
+}
+
 //------------------------------------------------------------------------------
 bool hasPPMextension(const std::string& fileName)
 {
-    if (fileName.length() > s_PPMextension.length())
+    // image.ppm.gz is a ppm too
+    std::string_view name = fileName;
+    name.remove_suffix(compressionSuffix(getCompression(fileName)).length());
+
+    if (name.length() > s_PPMextension.length())
     {
-        return fileName.compare(fileName.length() - s_PPMextension.length(),
-                                s_PPMextension.length(), s_PPMextension) == 0;
+        return name.compare(name.length() - s_PPMextension.length(),
+                            s_PPMextension.length(), s_PPMextension) == 0;
     }
 
     return false;
@@ -135,6 +504,39 @@ PPMType parseHeader(std::istream& f, ImageData& data)
     return type;
 }
 
+// Sets exceptionMsg if the region does not fit in the image
+bool checkRegion(uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+                 ImageData& data)
+{
+    if (width == 0 || height == 0
+        || static_cast<uint64_t>(x) + width > data.imageWidth
+        || static_cast<uint64_t>(y) + height > data.imageHeight)
+    {
+        data.exceptionMsg = "Region " + std::to_string(width) + "x"
+                            + std::to_string(height) + "+" + std::to_string(x)
+                            + "+" + std::to_string(y) + " is outside the "
+                            + std::to_string(data.imageWidth) + "x"
+                            + std::to_string(data.imageHeight) + " image";
+        return false;
+    }
+
+    return true;
+}
+
+// Keeps the aspect ratio, never scales up
+void getThumbnailSize(const ImageData& data, uint32_t maxSize,
+                      uint32_t& width, uint32_t& height)
+{
+    width = data.imageWidth;
+    height = data.imageHeight;
+    uint32_t longSide = std::max(width, height);
+    if (maxSize > 0 && longSide > maxSize)
+    {
+        width = std::max<uint32_t>(1, static_cast<uint64_t>(width) * maxSize / longSide);
+        height = std::max<uint32_t>(1, static_cast<uint64_t>(height) * maxSize / longSide);
+    }
+}
+
 // Only call if you're sure that there is anohter token in the stream
 bool getToken(std::istream& f, std::string& token)
 {
@@ -161,47 +563,261 @@ bool getToken(std::istream& f, std::string& token)
     return !token.empty();
 }
 
-void parseP3Data(std::istream& f, ImageData& data)
+std::string readRemaining(std::istream& f)
 {
-    std::vector<uint16_t> pixelData;
-    pixelData.reserve(data.imageWidth * data.imageHeight * 3);
-
     std::streampos currentPos = f.tellg();
     f.seekg(0, std::ios::end);
     std::streampos endPos = f.tellg();
     std::streamsize size = endPos - currentPos;
-    
+
     f.seekg(currentPos);
 
     std::string fileContent(size, '\0');
     f.read(reinterpret_cast<char*>(&fileContent[0]), size);
+    fileContent.resize(f.gcount());
+
+    return fileContent;
+}
+
+void parseP3Data(std::istream& f, ImageData& data, const std::string& fileName,
+                 bool storeInCache)
+{
+    const std::streamoff dataStart = f.tellg();
+    std::string fileContent = readRemaining(f);
+
+    parseP3Payload(fileContent, dataStart, data, fileName, storeInCache);
+}
 
-    const char* contentPtr = fileContent.c_str();
-    const char* endPtr = contentPtr + fileContent.size();
+// content starts at dataStart in the file. Every decode may read the pixel
+// cache, only full opens (storeInCache) add to it. Thumbnails, batches and
+// regions would otherwise fill it with images nobody views at full size
+void parseP3Payload(std::string_view content, std::streamoff dataStart,
+                    ImageData& data, const std::string& fileName,
+                    bool storeInCache)
+{
+    const bool cacheable = content.size() >= s_P3CacheMinSize;
+    if (cacheable && loadCachedPixels(fileName, content, data))
+    {
+        return;
+    }
 
-    while (contentPtr < endPtr)
+    RowIndex index;
+    if (loadRowIndex(fileName, data.imageHeight, index)
+        && parseP3Indexed(content, dataStart, index, data))
     {
-        while (contentPtr < endPtr && std::isspace(static_cast<unsigned char>(*contentPtr))) contentPtr++;
+        if (cacheable && storeInCache)
+            storeCachedPixels(fileName, content, data);
+        return;
+    }
+
+    // No index, or it did not match the content, so build a fresh one
+    const bool buildIndex = content.size() >= s_rowIndexMinSize;
+    index.offsets.clear();
+    parseP3Serial(content, dataStart, data, buildIndex ? &index : nullptr);
 
-        if (*contentPtr == '#')
+    if (buildIndex && data.isValid())
+        saveRowIndex(fileName, index);
+
+    if (cacheable && storeInCache && data.isValid())
+        storeCachedPixels(fileName, content, data);
+}
+
+void parseP3Serial(std::string_view content, std::streamoff dataStart,
+                   ImageData& data, RowIndex* index)
+{
+    const size_t rowSamples = static_cast<size_t>(data.imageWidth) * 3;
+    std::vector<uint16_t> pixelData(rowSamples * data.imageHeight);
+
+    const char* contentPtr = content.data();
+    const char* endPtr = contentPtr + content.size();
+
+    for (uint32_t row = 0; row < data.imageHeight; row++)
+    {
+        if (index && row % index->rowStride == 0)
         {
-            while (contentPtr < endPtr && *contentPtr != '\n') contentPtr++;
+            contentPtr = skipP3Separators(contentPtr, endPtr);
+            index->offsets.push_back(dataStart + (contentPtr - content.data()));
         }
 
-        char* next;
-        long value = std::strtol(contentPtr, &next, 10);
-        if (contentPtr == next) break;
-        contentPtr = next;
+        if (!parseP3Samples(contentPtr, endPtr, rowSamples, data.maxColorValue,
+                            pixelData.data() + row * rowSamples))
+        {
+            data.exceptionMsg = "Pixel data invalid or corrupted";
+            return;
+        }
+    }
 
-        if (data.maxColorValue <= 255)
-            value = (value * 255) / data.maxColorValue;
-        else
-            value = (value * 65535) / data.maxColorValue;
+    data.pixelData = std::move(pixelData);
+}
 
-        pixelData.emplace_back(static_cast<uint16_t>(value));
+// Every index entry starts a chunk of rows that can be parsed on its own
+bool parseP3Indexed(std::string_view content, std::streamoff dataStart,
+                    const RowIndex& index, ImageData& data)
+{
+    const size_t rowSamples = static_cast<size_t>(data.imageWidth) * 3;
+    std::vector<uint16_t> pixelData(rowSamples * data.imageHeight);
+
+    for (uint64_t offset : index.offsets)
+    {
+        if (offset < static_cast<uint64_t>(dataStart)
+            || offset - dataStart >= content.size())
+        {
+            return false;
+        }
     }
 
+    auto parseChunks = [&](size_t firstChunk, size_t lastChunk)
+    {
+        for (size_t chunk = firstChunk; chunk < lastChunk; chunk++)
+        {
+            uint32_t firstRow = chunk * index.rowStride;
+            uint32_t rowCount = std::min(index.rowStride, data.imageHeight - firstRow);
+
+            const char* contentPtr = content.data() + (index.offsets[chunk] - dataStart);
+            const char* endPtr = content.data() + content.size();
+            if (!parseP3Samples(contentPtr, endPtr, rowCount * rowSamples,
+                                data.maxColorValue,
+                                pixelData.data() + firstRow * rowSamples))
+            {
+                return false;
+            }
+
+            // A file rewritten with the same size and mtime still has to
+            // line up with the index
+            if (chunk + 1 < index.offsets.size()
+                && skipP3Separators(contentPtr, endPtr)
+                   != content.data() + (index.offsets[chunk + 1] - dataStart))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    };
+
+    const size_t chunkCount = index.offsets.size();
+    const size_t taskCount = std::min<size_t>(chunkCount,
+                                              std::max(1u, std::thread::hardware_concurrency()));
+
+    std::vector<std::future<bool>> tasks;
+    for (size_t task = 0; task < taskCount; task++)
+    {
+        tasks.push_back(std::async(std::launch::async, parseChunks,
+                                   chunkCount * task / taskCount,
+                                   chunkCount * (task + 1) / taskCount));
+    }
+
+    bool success = true;
+    for (std::future<bool>& task : tasks)
+    {
+        success = task.get() && success;
+    }
+
+    if (success)
+        data.pixelData = std::move(pixelData);
+
+    return success;
+}
+
+// Reads and parses only the chunks covering the rows, leaves full width rows
+// in data
+bool parseP3Region(std::istream& f, const RowIndex& index,
+                   uint32_t y, uint32_t height, ImageData& data)
+{
+    const size_t rowSamples = static_cast<size_t>(data.imageWidth) * 3;
+    const size_t firstChunk = y / index.rowStride;
+    const size_t lastChunk = (y + height - 1) / index.rowStride + 1;
+    const uint32_t firstRow = firstChunk * index.rowStride;
+
+    std::streamoff start = index.offsets[firstChunk];
+    std::string content;
+    f.seekg(start);
+    if (lastChunk < index.offsets.size())
+    {
+        content.resize(index.offsets[lastChunk] - start);
+        f.read(content.data(), content.size());
+        content.resize(f.gcount());
+    }
+    else
+    {
+        content = readRemaining(f);
+    }
+
+    // Whole chunks are parsed, so their ends can be checked against the
+    // index. Rows outside the region are dropped afterwards
+    const uint32_t rowCount = std::min<uint64_t>(lastChunk * index.rowStride,
+                                                 data.imageHeight) - firstRow;
+    std::vector<uint16_t> pixelData(rowSamples * rowCount);
+
+    const char* contentPtr = content.data();
+    const char* endPtr = content.data() + content.size();
+    for (size_t chunk = firstChunk; chunk < lastChunk; chunk++)
+    {
+        const uint32_t chunkRow = chunk * index.rowStride;
+        const uint32_t chunkRows = std::min(index.rowStride, data.imageHeight - chunkRow);
+        if (!parseP3Samples(contentPtr, endPtr, chunkRows * rowSamples, data.maxColorValue,
+                            pixelData.data() + (chunkRow - firstRow) * rowSamples))
+        {
+            return false;
+        }
+
+        if (chunk + 1 < index.offsets.size()
+            && skipP3Separators(contentPtr, endPtr)
+               != content.data() + (index.offsets[chunk + 1] - start))
+        {
+            return false;
+        }
+    }
+
+    pixelData.resize((y + height - firstRow) * rowSamples);
+    pixelData.erase(pixelData.begin(), pixelData.begin() + (y - firstRow) * rowSamples);
     data.pixelData = std::move(pixelData);
+    data.imageHeight = height;
+
+    return true;
+}
+
+// Returns false if fewer than sampleCount samples could be parsed
+bool parseP3Samples(const char*& ptr, const char* end, size_t sampleCount,
+                    uint32_t maxColorValue, uint16_t* dst)
+{
+    const uint64_t range = maxColorValue <= 255 ? 255 : 65535;
+
+    for (size_t it = 0; it < sampleCount; it++)
+    {
+        ptr = skipP3Separators(ptr, end);
+
+        uint32_t value;
+        std::from_chars_result result = std::from_chars(ptr, end, value);
+        if (result.ec != std::errc()) return false;
+        ptr = result.ptr;
+
+        dst[it] = static_cast<uint16_t>((value * range) / maxColorValue);
+    }
+
+    return true;
+}
+
+// Skips whitespace and comments
+const char* skipP3Separators(const char* ptr, const char* end)
+{
+    while (ptr < end)
+    {
+        if (*ptr == s_commentChar)
+        {
+            while (ptr < end && *ptr != '\n') ptr++;
+        }
+        else if (std::isspace(static_cast<unsigned char>(*ptr)))
+        {
+            ptr++;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    return ptr;
 }
 
 void parseP6Data(std::istream& f, ImageData& data)
@@ -217,71 +833,532 @@ void parseP6Data(std::istream& f, ImageData& data)
     // width * height * bytesPerSample
     // But I'm doing it anyway for learning purposes
 
-    uint32_t channelCount = 0;
-    if (data.maxColorValue <= 255)
+    std::string buffer(dataSize, '\0');
+
+    if (!f.read(buffer.data(), dataSize))
+    {
+        data.exceptionMsg = "Error: could only read " +
+                            std::to_string(f.gcount()) +
+                            " of " + std::to_string(dataSize) + " bytes!";
+        return;
+    }
+
+    parseP6Payload(buffer, data);
+}
+
+void parseP6Payload(std::string_view payload, ImageData& data)
+{
+    size_t sampleCount = static_cast<size_t>(data.imageWidth) * data.imageHeight * 3;
+    if (payload.size() != sampleCount * bytesPerSample(data.maxColorValue))
+    {
+        data.exceptionMsg = "Pixel data invalid or corrupted";
+        return;
+    }
+
+    data.pixelData.resize(sampleCount);
+    convertP6Samples(reinterpret_cast<const uint8_t*>(payload.data()), sampleCount,
+                     data.maxColorValue, data.pixelData.data());
+}
+
+// Maps raw P6 samples to the full 8 or 16-bit range
+void convertP6Samples(const uint8_t* src, size_t sampleCount,
+                      uint32_t maxColorValue, uint16_t* dst)
+{
+    if (maxColorValue <= 255)
+    {
+        for (size_t it = 0; it < sampleCount; it++)
+        {
+            dst[it] = static_cast<uint16_t>((src[it] * 255u) / maxColorValue);
+        }
+    }
+    else
     {
-        std::vector<uint8_t> buffer(dataSize);
+        for (size_t it = 0; it < sampleCount; it++)
+        {
+            uint32_t value = (src[2 * it] << 8) | src[2 * it + 1];
+            dst[it] = static_cast<uint16_t>((value * 65535u) / maxColorValue);
+        }
+    }
+}
 
-        if (!f.read(reinterpret_cast<char*>(buffer.data()), dataSize))
+void parseP6Region(std::istream& f, uint32_t x, uint32_t y,
+                   uint32_t width, uint32_t height, ImageData& data)
+{
+    const std::streamoff dataStart = f.tellg();
+    const size_t sampleSize = bytesPerSample(data.maxColorValue);
+    const size_t rowBytes = static_cast<size_t>(data.imageWidth) * 3 * sampleSize;
+    const size_t spanBytes = static_cast<size_t>(width) * 3 * sampleSize;
+
+    std::vector<uint8_t> buffer(spanBytes * height);
+
+    // Full width rows are contiguous in the file, so a single read does it
+    uint32_t readCount = width == data.imageWidth ? 1 : height;
+    size_t readBytes = width == data.imageWidth ? buffer.size() : spanBytes;
+
+    for (uint32_t row = 0; row < readCount; row++)
+    {
+        std::streamoff offset = dataStart
+                                + static_cast<std::streamoff>((y + row) * rowBytes)
+                                + static_cast<std::streamoff>(x * 3 * sampleSize);
+        f.seekg(offset);
+
+        if (!f.read(reinterpret_cast<char*>(buffer.data() + row * spanBytes), readBytes))
         {
             data.exceptionMsg = "Error: could only read " +
                                 std::to_string(f.gcount()) +
-                                " of " + std::to_string(dataSize) + " bytes!";
+                                " of " + std::to_string(readBytes) +
+                                " bytes at row " + std::to_string(y + row) + "!";
             return;
         }
+    }
 
-        data.pixelData.reserve(data.imageWidth * data.imageHeight * 3);
-        for (size_t it = 0; it < buffer.size(); it += 3)
-        {
-            uint16_t r = buffer[it];
-            uint16_t g = buffer[it + 1];
-            uint16_t b = buffer[it + 2];
+    size_t sampleCount = static_cast<size_t>(width) * height * 3;
+    data.pixelData.resize(sampleCount);
+    convertP6Samples(buffer.data(), sampleCount, data.maxColorValue,
+                     data.pixelData.data());
 
-            // Map each value to 8-bit range
-            r = (r * 255) / data.maxColorValue;
-            g = (g * 255) / data.maxColorValue;
-            b = (b * 255) / data.maxColorValue;
+    data.imageWidth = width;
+    data.imageHeight = height;
+}
 
-            data.pixelData.emplace_back(r);
-            data.pixelData.emplace_back(g);
-            data.pixelData.emplace_back(b);
-            channelCount += 3;
-        }
-    }
-    else
+// Point samples the image, reading only the rows that are sampled
+void parseP6Thumbnail(std::istream& f, uint32_t width, uint32_t height,
+                      ImageData& data)
+{
+    const std::streamoff dataStart = f.tellg();
+    const size_t sampleSize = bytesPerSample(data.maxColorValue);
+    const size_t rowBytes = static_cast<size_t>(data.imageWidth) * 3 * sampleSize;
+
+    std::vector<uint8_t> row(rowBytes);
+    std::vector<uint16_t> pixelData(static_cast<size_t>(width) * height * 3);
+    uint16_t* dst = pixelData.data();
+
+    for (uint32_t outY = 0; outY < height; outY++)
     {
-        std::vector<uint8_t> buffer(dataSize);
+        uint64_t srcY = (2 * static_cast<uint64_t>(outY) + 1) * data.imageHeight
+                        / (2 * static_cast<uint64_t>(height));
+        f.seekg(dataStart + static_cast<std::streamoff>(srcY * rowBytes));
 
-        if (!f.read(reinterpret_cast<char*>(buffer.data()), dataSize))
+        if (!f.read(reinterpret_cast<char*>(row.data()), rowBytes))
         {
             data.exceptionMsg = "Error: could only read " +
                                 std::to_string(f.gcount()) +
-                                " of " + std::to_string(dataSize) + " bytes!";
+                                " of " + std::to_string(rowBytes) +
+                                " bytes at row " + std::to_string(srcY) + "!";
             return;
         }
 
-        data.pixelData.reserve(data.imageWidth * data.imageHeight * 3);
-        for (size_t it = 0; it < buffer.size(); it += 6)
+        for (uint32_t outX = 0; outX < width; outX++)
+        {
+            uint64_t srcX = (2 * static_cast<uint64_t>(outX) + 1) * data.imageWidth
+                            / (2 * static_cast<uint64_t>(width));
+            convertP6Samples(row.data() + srcX * 3 * sampleSize, 3,
+                             data.maxColorValue, dst);
+            dst += 3;
+        }
+    }
+
+    data.pixelData = std::move(pixelData);
+    data.imageWidth = width;
+    data.imageHeight = height;
+}
+
+// The decompressed payload never exists as a whole, so neither the row index
+// nor the pixel cache apply
+void parseCompressedData(Decompressor& source, ImageData& data)
+{
+    ChunkBuffer chunks(source);
+    std::istream stream(&chunks);
+
+    switch (parseHeader(stream, data))
+    {
+        case PPMType::P3:
+            parseP3Stream(chunks, data);
+            break;
+
+        case PPMType::P6:
+            parseP6Stream(chunks, data);
+            break;
+
+        case PPMType::None:
+            break;
+    }
+
+    // A broken or truncated stream usually shows up as a short payload first,
+    // the reason is more useful
+    std::string error = source.error();
+    if (!error.empty())
+        data.exceptionMsg = error;
+}
+
+// A token or comment can span two chunks. Each chunk is parsed up to its
+// last separator outside a comment, the rest is carried over to the next one
+void parseP3Stream(ChunkBuffer& chunks, ImageData& data)
+{
+    const size_t sampleCount = static_cast<size_t>(data.imageWidth) * data.imageHeight * 3;
+    std::vector<uint16_t> pixelData(sampleCount);
+    size_t parsed = 0;
+    bool valid = true;
+
+    auto parseLines = [&](const char* ptr, const char* end)
+    {
+        while (valid && parsed < sampleCount)
+        {
+            ptr = skipP3Separators(ptr, end);
+            if (ptr == end) return;
+
+            valid = parseP3Samples(ptr, end, 1, data.maxColorValue,
+                                   pixelData.data() + parsed);
+            parsed++;
+        }
+    };
+
+    std::string carry;
+    std::string_view span;
+    while (chunks.nextSpan(span))
+    {
+        if (!valid) break;
+        // Trailing data is ignored like for plain files, but it still has to
+        // decompress
+        if (parsed == sampleCount) continue;
+
+        size_t carryComment = carry.rfind(s_commentChar);
+        size_t carryBreak = carry.rfind('\n');
+        bool inComment = carryComment != std::string::npos
+                         && (carryBreak == std::string::npos || carryBreak < carryComment);
+
+        // A comment on the last line reaches the end of the chunk, so split
+        // where it starts. Otherwise split at the last whitespace
+        size_t lastBreak = span.rfind('\n');
+        size_t split = std::string_view::npos;
+        if (lastBreak != std::string_view::npos || !inComment)
+        {
+            size_t lineStart = lastBreak == std::string_view::npos ? 0 : lastBreak + 1;
+            split = span.find(s_commentChar, lineStart);
+            if (split == std::string_view::npos)
+                split = span.find_last_of(s_whitespace);
+        }
+        if (split == std::string_view::npos)
+        {
+            carry.append(span);
+            continue;
+        }
+
+        // Complete the token or comment left over from the previous chunk
+        size_t first = inComment ? span.find('\n') : span.find_first_of(s_P3Separators);
+        carry.append(span.substr(0, first));
+        parseLines(carry.data(), carry.data() + carry.size());
+
+        parseLines(span.data() + first, span.data() + split);
+        carry.assign(span.substr(split));
+    }
+    parseLines(carry.data(), carry.data() + carry.size());
+
+    if (!valid || parsed != sampleCount)
+    {
+        data.exceptionMsg = "Pixel data invalid or corrupted";
+        return;
+    }
+
+    data.pixelData = std::move(pixelData);
+}
+
+// A 16-bit sample can be split between two chunks
+void parseP6Stream(ChunkBuffer& chunks, ImageData& data)
+{
+    const size_t sampleCount = static_cast<size_t>(data.imageWidth) * data.imageHeight * 3;
+    const size_t sampleSize = bytesPerSample(data.maxColorValue);
+    std::vector<uint16_t> pixelData(sampleCount);
+    size_t converted = 0;
+    bool overrun = false;
+
+    uint8_t split[2];
+    bool hasSplit = false;
+
+    std::string_view span;
+    while (chunks.nextSpan(span))
+    {
+        const uint8_t* src = reinterpret_cast<const uint8_t*>(span.data());
+        size_t size = span.size();
+
+        if (hasSplit)
         {
-            uint16_t r = (buffer[it] << 8) | buffer[it + 1];
-            uint16_t g = (buffer[it + 2] << 8) | buffer[it + 3];
-            uint16_t b = (buffer[it + 4] << 8) | buffer[it + 5];
+            split[1] = *src++;
+            size--;
+            convertP6Samples(split, 1, data.maxColorValue, pixelData.data() + converted);
+            converted++;
+            hasSplit = false;
+        }
 
-            // Map each value to 16-bit range
-            r = (r * 65535) / data.maxColorValue;
-            g = (g * 65535) / data.maxColorValue;
-            b = (b * 65535) / data.maxColorValue;
+        size_t count = std::min(size / sampleSize, sampleCount - converted);
+        convertP6Samples(src, count, data.maxColorValue, pixelData.data() + converted);
+        converted += count;
 
-            data.pixelData.emplace_back(r);
-            data.pixelData.emplace_back(g);
-            data.pixelData.emplace_back(b);
-            channelCount += 3;
+        size_t rest = size - count * sampleSize;
+        if (rest > 0 && converted < sampleCount)
+        {
+            split[0] = src[count * sampleSize];
+            hasSplit = true;
+        }
+        else if (rest > 0)
+        {
+            overrun = true;
         }
     }
 
-    if (channelCount != data.imageWidth * data.imageHeight * 3)
+    // Same as for plain files the payload has to match the size exactly
+    if (converted != sampleCount || hasSplit || overrun)
     {
         data.exceptionMsg = "Pixel data invalid or corrupted";
         return;
     }
+
+    data.pixelData = std::move(pixelData);
+}
+
+// Point samples an already decoded image down to the given size
+void sampleImage(uint32_t width, uint32_t height, ImageData& data)
+{
+    if (width == data.imageWidth && height == data.imageHeight) return;
+
+    std::vector<uint16_t> pixelData(static_cast<size_t>(width) * height * 3);
+    uint16_t* dst = pixelData.data();
+
+    for (uint32_t outY = 0; outY < height; outY++)
+    {
+        uint64_t srcY = (2 * static_cast<uint64_t>(outY) + 1) * data.imageHeight
+                        / (2 * static_cast<uint64_t>(height));
+        for (uint32_t outX = 0; outX < width; outX++)
+        {
+            uint64_t srcX = (2 * static_cast<uint64_t>(outX) + 1) * data.imageWidth
+                            / (2 * static_cast<uint64_t>(width));
+            const uint16_t* src = data.pixelData.data()
+                                  + (srcY * data.imageWidth + srcX) * 3;
+            *dst++ = src[0];
+            *dst++ = src[1];
+            *dst++ = src[2];
+        }
+    }
+
+    data.pixelData = std::move(pixelData);
+    data.imageWidth = width;
+    data.imageHeight = height;
+}
+
+// Copies the region out of an already decoded image
+void cropImage(uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+               ImageData& data)
+{
+    const size_t rowSamples = static_cast<size_t>(data.imageWidth) * 3;
+    const size_t spanSamples = static_cast<size_t>(width) * 3;
+
+    std::vector<uint16_t> pixelData(spanSamples * height);
+    for (uint32_t row = 0; row < height; row++)
+    {
+        const uint16_t* src = data.pixelData.data() + (y + row) * rowSamples + x * 3;
+        std::copy(src, src + spanSamples, pixelData.begin() + row * spanSamples);
+    }
+
+    data.pixelData = std::move(pixelData);
+    data.imageWidth = width;
+    data.imageHeight = height;
+}
+
+void writeP6Data(int fd, std::string& header, ImageData& data)
+{
+    const size_t sampleCount = data.pixelData.size();
+
+    iovec iov[2];
+    iov[0].iov_base = header.data();
+    iov[0].iov_len = header.size();
+
+    std::vector<uint8_t> buffer8;
+    std::vector<uint16_t> buffer16;
+    if (data.maxColorValue <= 255)
+    {
+        buffer8.resize(sampleCount);
+        packSamples8(data.pixelData.data(), sampleCount, buffer8.data());
+        iov[1].iov_base = buffer8.data();
+        iov[1].iov_len = buffer8.size();
+    }
+    else if (std::endian::native == std::endian::big)
+    {
+        // Samples are already stored the way P6 wants them
+        iov[1].iov_base = data.pixelData.data();
+        iov[1].iov_len = sampleCount * sizeof(uint16_t);
+    }
+    else
+    {
+        buffer16.resize(sampleCount);
+        swapSamples16(data.pixelData.data(), sampleCount, buffer16.data());
+        iov[1].iov_base = buffer16.data();
+        iov[1].iov_len = sampleCount * sizeof(uint16_t);
+    }
+
+    if (!writeAll(fd, iov, 2))
+    {
+        data.exceptionMsg = "Error: writing pixel data failed: "
+                            + std::string(std::strerror(errno));
+    }
+}
+
+void writeP3Data(int fd, std::string& header, ImageData& data)
+{
+    iovec iov;
+    iov.iov_base = header.data();
+    iov.iov_len = header.size();
+    if (!writeAll(fd, &iov, 1))
+    {
+        data.exceptionMsg = "Error: writing header failed: "
+                            + std::string(std::strerror(errno));
+        return;
+    }
+
+    // Bands are formatted on worker threads, but written strictly in order.
+    // Only as many bands as there are threads are kept in flight.
+    const size_t maxInFlight = std::max(1u, std::thread::hardware_concurrency());
+    std::deque<std::future<std::string>> bands;
+    uint32_t nextRow = 0;
+
+    auto launchBand = [&]()
+    {
+        uint32_t rowCount = std::min(s_P3BandRows, data.imageHeight - nextRow);
+        bands.push_back(std::async(std::launch::async, formatP3Band,
+                                   std::cref(data), nextRow, rowCount));
+        nextRow += rowCount;
+    };
+
+    while (nextRow < data.imageHeight && bands.size() < maxInFlight)
+        launchBand();
+
+    while (!bands.empty())
+    {
+        std::string band = bands.front().get();
+        bands.pop_front();
+
+        if (nextRow < data.imageHeight)
+            launchBand();
+
+        iov.iov_base = band.data();
+        iov.iov_len = band.size();
+        if (!writeAll(fd, &iov, 1))
+        {
+            // Whatever is still in flight is joined by the future destructors
+            data.exceptionMsg = "Error: writing pixel data failed: "
+                                + std::string(std::strerror(errno));
+            return;
+        }
+    }
+}
+
+std::string formatP3Band(const ImageData& data, uint32_t firstRow, uint32_t rowCount)
+{
+    const size_t rowSamples = static_cast<size_t>(data.imageWidth) * 3;
+
+    // At most 5 digits and one separator per sample
+    std::string band(rowSamples * rowCount * 6, '\0');
+    char* ptr = band.data();
+    char* lineStart = ptr;
+
+    const uint16_t* sample = data.pixelData.data() + firstRow * rowSamples;
+    for (uint32_t row = 0; row < rowCount; row++)
+    {
+        for (size_t it = 0; it < rowSamples; it++)
+        {
+            char digits[5];
+            size_t length = std::to_chars(digits, digits + sizeof(digits),
+                                          sample[it]).ptr - digits;
+
+            if (ptr != lineStart)
+            {
+                if (static_cast<size_t>(ptr - lineStart) + 1 + length > s_P3LineLength)
+                {
+                    *ptr++ = '\n';
+                    lineStart = ptr;
+                }
+                else
+                {
+                    *ptr++ = ' ';
+                }
+            }
+
+            std::memcpy(ptr, digits, length);
+            ptr += length;
+        }
+
+        // Every row starts on its own line
+        *ptr++ = '\n';
+        lineStart = ptr;
+        sample += rowSamples;
+    }
+
+    band.resize(ptr - band.data());
+    return band;
+}
+
+// Keeps calling writev until everything is written
+bool writeAll(int fd, iovec* iov, int iovCount)
+{
+    while (iovCount > 0)
+    {
+        ssize_t written = ::writev(fd, iov, iovCount);
+        if (written < 0)
+        {
+            if (errno == EINTR) continue;
+            return false;
+        }
+
+        // Skip the buffers that were fully written and trim the partial one
+        size_t remaining = static_cast<size_t>(written);
+        while (iovCount > 0 && remaining >= iov->iov_len)
+        {
+            remaining -= iov->iov_len;
+            iov++;
+            iovCount--;
+        }
+
+        if (iovCount > 0)
+        {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + remaining;
+            iov->iov_len -= remaining;
+        }
+    }
+
+    return true;
+}
+
+void packSamples8(const uint16_t* src, size_t count, uint8_t* dst)
+{
+    size_t it = 0;
+#ifdef __SSE2__
+    for (; it + 16 <= count; it += 16)
+    {
+        __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + it));
+        __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + it + 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + it),
+                         _mm_packus_epi16(low, high));
+    }
+#endif
+    for (; it < count; it++)
+    {
+        dst[it] = static_cast<uint8_t>(src[it]);
+    }
+}
+
+// P6 stores 16-bit samples as big-endian
+void swapSamples16(const uint16_t* src, size_t count, uint16_t* dst)
+{
+    size_t it = 0;
+#ifdef __SSE2__
+    for (; it + 8 <= count; it += 8)
+    {
+        __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + it));
+        value = _mm_or_si128(_mm_slli_epi16(value, 8), _mm_srli_epi16(value, 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + it), value);
+    }
+#endif
+    for (; it < count; it++)
+    {
+        dst[it] = static_cast<uint16_t>((src[it] << 8) | (src[it] >> 8));
+    }
 }
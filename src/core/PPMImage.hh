@@ -5,6 +5,13 @@
 #include <vector>
 #include <cstdint>
 
+enum class PPMType
+{
+    None = 0,
+    P3,
+    P6
+};
+
 struct ImageData
 {
     uint32_t imageWidth;
@@ -18,4 +25,26 @@ struct ImageData
 
 void getImageData(const std::string& fileName, ImageData& data);
 
+// Decodes a file that was already read into memory. fileName is only used
+// for the P3 row index
+void decodeImageBuffer(const std::string& fileName, const char* buffer,
+                       size_t size, ImageData& data);
+
+// Decodes only the given region. For P6 only the rows of the region are read,
+// data holds the cropped image afterwards
+void getImageRegion(const std::string& fileName, uint32_t x, uint32_t y,
+                    uint32_t width, uint32_t height, ImageData& data);
+
+// Reduced cost decode for previews, the result fits in maxSize x maxSize.
+// For P6 only the sampled rows are read
+void getImageThumbnail(const std::string& fileName, uint32_t maxSize,
+                       ImageData& data);
+
+// Writes the image as P3 or P6. Samples are written at the depth they are
+// stored in (255 or 65535), errors are reported through data.exceptionMsg
+void writeImageData(const std::string& fileName, ImageData& data,
+                    PPMType type = PPMType::P6);
+
+bool hasPPMextension(const std::string& fileName);
+
 #endif // PARSER_HH
@@ -0,0 +1,120 @@
+#include "PPMIndex.hh"
+
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/stat.h>
+
+// Version is part of the magic, an index from an older layout is just stale
+constexpr char s_indexMagic[8] = {'P', 'P', 'M', 'I', 'D', 'X', '0', '1'};
+const std::string s_indexExtension = ".idx";
+
+// Stored in native byte order, the index never leaves the machine that made it
+struct IndexHeader
+{
+    char magic[8];
+    uint64_t fileSize;
+    int64_t mtime; // nanoseconds
+    uint32_t rowStride;
+    uint32_t entryCount;
+};
+
+//------------------------------------------------------------------------------
+bool getFileKey(const std::string& fileName, uint64_t& fileSize, int64_t& mtime);
+
+//------------------------------------------------------------------------------
+std::string rowIndexPath(const std::string& fileName)
+{
+    return fileName + s_indexExtension;
+}
+
+bool loadRowIndex(const std::string& fileName, uint32_t imageHeight, RowIndex& index)
+{
+    uint64_t fileSize;
+    int64_t mtime;
+    if (!getFileKey(fileName, fileSize, mtime)) return false;
+
+    std::ifstream fileObj(rowIndexPath(fileName), std::ios::in | std::ios::binary);
+    if (!fileObj) return false;
+
+    IndexHeader header;
+    if (!fileObj.read(reinterpret_cast<char*>(&header), sizeof(header)))
+        return false;
+
+    if (std::memcmp(header.magic, s_indexMagic, sizeof(s_indexMagic)) != 0
+        || header.fileSize != fileSize || header.mtime != mtime
+        || header.rowStride == 0)
+    {
+        return false;
+    }
+
+    RowIndex loaded;
+    loaded.rowStride = header.rowStride;
+    if (header.entryCount != loaded.entryCount(imageHeight)) return false;
+
+    loaded.offsets.resize(header.entryCount);
+    if (!fileObj.read(reinterpret_cast<char*>(loaded.offsets.data()),
+                      loaded.offsets.size() * sizeof(uint64_t)))
+    {
+        return false;
+    }
+
+    // Offsets have to be increasing and inside the file
+    for (size_t it = 0; it < loaded.offsets.size(); it++)
+    {
+        if (loaded.offsets[it] >= fileSize
+            || (it > 0 && loaded.offsets[it] <= loaded.offsets[it - 1]))
+        {
+            return false;
+        }
+    }
+
+    index = std::move(loaded);
+    return true;
+}
+
+void saveRowIndex(const std::string& fileName, const RowIndex& index)
+{
+    IndexHeader header;
+    std::memcpy(header.magic, s_indexMagic, sizeof(s_indexMagic));
+    header.rowStride = index.rowStride;
+    header.entryCount = static_cast<uint32_t>(index.offsets.size());
+    if (!getFileKey(fileName, header.fileSize, header.mtime)) return;
+
+    // Written to a temporary name first so that a reader never sees half of it
+    std::string indexPath = rowIndexPath(fileName);
+    std::string tempPath = indexPath + ".tmp";
+    {
+        std::ofstream fileObj(tempPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!fileObj) return;
+
+        fileObj.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        fileObj.write(reinterpret_cast<const char*>(index.offsets.data()),
+                      index.offsets.size() * sizeof(uint64_t));
+        if (!fileObj)
+        {
+            fileObj.close();
+            std::remove(tempPath.c_str());
+            return;
+        }
+    }
+
+    if (std::rename(tempPath.c_str(), indexPath.c_str()) != 0)
+    {
+        std::remove(tempPath.c_str());
+    }
+}
+
+//------------------------------------------------------------------------------
+bool getFileKey(const std::string& fileName, uint64_t& fileSize, int64_t& mtime)
+{
+    struct stat info;
+    if (::stat(fileName.c_str(), &info) != 0) return false;
+
+    fileSize = static_cast<uint64_t>(info.st_size);
+    mtime = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000
+            + info.st_mtim.tv_nsec;
+
+    return true;
+}
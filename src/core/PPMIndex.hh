@@ -0,0 +1,41 @@
+#ifndef PPM_INDEX_HH
+#define PPM_INDEX_HH
+
+/*
+ * Row offset index for P3 files
+ *
+ * P3 tokens have variable length, so a row can only be found by parsing
+ * everything before it. The index stores the byte offset of every
+ * rowStride-th row, which lets a decoder jump close to any row and split
+ * the work across threads at exact row boundaries.
+ *
+ * The index lives next to the image as <image>.idx and is keyed by the size
+ * and mtime of the image. A stale index is ignored and rebuilt on the next
+ * full decode.
+ */
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+struct RowIndex
+{
+    uint32_t rowStride = 64;
+    // offsets[i] is the file offset of the first sample of row i * rowStride
+    std::vector<uint64_t> offsets;
+
+    // Number of entries needed for an image of the given height
+    inline size_t entryCount(uint32_t imageHeight) const
+    {
+        return (imageHeight + rowStride - 1) / rowStride;
+    }
+};
+
+std::string rowIndexPath(const std::string& fileName);
+
+// Returns false if there is no index or it does not belong to the file anymore
+bool loadRowIndex(const std::string& fileName, uint32_t imageHeight, RowIndex& index);
+// Best effort, an index that can't be written is simply not used
+void saveRowIndex(const std::string& fileName, const RowIndex& index);
+
+#endif // PPM_INDEX_HH
@@ -54,6 +54,11 @@ void Shader::setUniform1f(const std::string& name, float value)
     glUniform1f(getUniformLocation(name), value);
 }
 
+void Shader::setUniform2f(const std::string& name, float x, float y)
+{
+    glUniform2f(getUniformLocation(name), x, y);
+}
+
 
 int Shader::getUniformLocation(const std::string& name)
 {
@@ -59,6 +59,7 @@ public:
     // I trust ur intelligence
     void setUniform1i(const std::string& name, int value);
     void setUniform1f(const std::string& name, float value);
+    void setUniform2f(const std::string& name, float x, float y);
 
 private:
     unsigned int m_renderedId;
@@ -1,7 +1,20 @@
 #include "application.hh"
 #include "renderer.hh"
+#include "gridRenderer.hh"
+#include "thumbnails.hh"
+#include "resampler.hh"
 
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
 #include <iostream>
+#include <string_view>
+
+// Longest side of a contact sheet thumbnail
+constexpr uint32_t s_thumbnailSize = 160;
+
+bool parseNumber(std::string_view text, uint32_t& value);
 
 Application::Application() {}
 Application::~Application() {}
@@ -12,32 +25,150 @@ int Application::run(int argc, char** argv)
 
     if (m_fileName.empty())
     {
-        displayErrorMsg("Usage: ppm-viewer image.ppm");
+        displayErrorMsg("Usage: ppm-viewer image.ppm [x y width height]\n"
+                        "       ppm-viewer image.ppm --export WIDTHxHEIGHT out.ppm\n"
+                        "       ppm-viewer directory");
         return -1;
     }
 
+    if (std::filesystem::is_directory(m_fileName))
+    {
+        return runGrid();
+    }
+
     if (!loadImageData())
     {
         return -1;
     }
 
+    if (!m_exportPath.empty())
+    {
+        return exportImage();
+    }
+
     Renderer renderer(m_imageData);
     renderer.run();
 
     return 0;
 }
 
+int Application::runGrid()
+{
+    std::vector<std::string> files = listPPMFiles(m_fileName);
+    if (files.empty())
+    {
+        std::string msg = "No .ppm files in " + m_fileName;
+        displayErrorMsg(msg.c_str());
+        return -1;
+    }
+
+    std::vector<ImageData> thumbnails;
+    loadThumbnails(files, s_thumbnailSize, thumbnails);
+
+    for (size_t it = 0; it < files.size(); it++)
+    {
+        if (!thumbnails[it].isValid())
+            std::cerr << "Skipping " << files[it] << ": "
+                      << thumbnails[it].exceptionMsg << '\n';
+    }
+
+    GridRenderer renderer(std::move(thumbnails), s_thumbnailSize,
+                          "ppm-viewer - " + m_fileName);
+    renderer.run();
+
+    return 0;
+}
+
+int Application::exportImage()
+{
+    uint32_t width = m_exportWidth;
+    uint32_t height = m_exportHeight;
+    if (width == 0)
+    {
+        width = std::max<uint64_t>(1, static_cast<uint64_t>(m_imageData.imageWidth)
+                                      * height / m_imageData.imageHeight);
+    }
+    if (height == 0)
+    {
+        height = std::max<uint64_t>(1, static_cast<uint64_t>(m_imageData.imageHeight)
+                                       * width / m_imageData.imageWidth);
+    }
+
+    resampleImage(m_imageData, width, height, ResampleFilter::Lanczos3, m_imageData);
+    if (m_imageData.isValid())
+    {
+        writeImageData(m_exportPath, m_imageData, PPMType::P6);
+    }
+
+    if (!m_imageData.isValid())
+    {
+        std::cerr << "Error: " << m_imageData.exceptionMsg << '\n';
+        return -1;
+    }
+
+    return 0;
+}
+
 void Application::parseArguments(int argc, char** argv)
 {
     if (argc == 2)
     {
         m_fileName = argv[1];
     }
+    else if (argc == 5 && std::strcmp(argv[2], "--export") == 0)
+    {
+        std::string_view size = argv[3];
+        size_t separator = size.find('x');
+        uint32_t width = 0;
+        uint32_t height = 0;
+        if (separator == std::string_view::npos
+            || !parseNumber(size.substr(0, separator), width)
+            || !parseNumber(size.substr(separator + 1), height)
+            || (width == 0 && height == 0))
+        {
+            return; // leaves m_fileName empty so the usage is shown
+        }
+
+        m_fileName = argv[1];
+        m_exportPath = argv[4];
+        m_exportWidth = width;
+        m_exportHeight = height;
+    }
+    else if (argc == 6)
+    {
+        if (!parseNumber(argv[2], m_regionX) || !parseNumber(argv[3], m_regionY)
+            || !parseNumber(argv[4], m_regionWidth) || !parseNumber(argv[5], m_regionHeight))
+        {
+            return; // leaves m_fileName empty so the usage is shown
+        }
+
+        m_fileName = argv[1];
+        m_hasRegion = true;
+    }
+}
+
+// Whole string as an unsigned decimal. std::stoul and scanf("%u") accept
+// "-1" and wrap it around to a huge size
+bool parseNumber(std::string_view text, uint32_t& value)
+{
+    if (text.empty() || text.front() == '-') return false;
+
+    const char* end = text.data() + text.size();
+    std::from_chars_result result = std::from_chars(text.data(), end, value);
+    return result.ec == std::errc() && result.ptr == end;
 }
 
 bool Application::loadImageData()
 {
-    getImageData(m_fileName, m_imageData);
+    if (m_hasRegion)
+    {
+        getImageRegion(m_fileName, m_regionX, m_regionY,
+                       m_regionWidth, m_regionHeight, m_imageData);
+    }
+    else
+    {
+        getImageData(m_fileName, m_imageData);
+    }
 
     if (!m_imageData.isValid())
     {
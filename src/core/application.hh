@@ -14,6 +14,10 @@ public:
 
     int run(int argc, char** argv);
 private:
+    // Contact sheet of all images in the m_fileName directory
+    int runGrid();
+    // Resamples the image and writes it to m_exportPath, no window involved
+    int exportImage();
     void parseArguments(int argc, char** argv);
     bool loadImageData();
     void displayErrorMsg(const char* msg);
@@ -21,6 +25,18 @@ private:
 private:
     std::string m_fileName;
     ImageData m_imageData;
+
+    // Optional region to view instead of the whole image
+    bool m_hasRegion = false;
+    uint32_t m_regionX = 0;
+    uint32_t m_regionY = 0;
+    uint32_t m_regionWidth = 0;
+    uint32_t m_regionHeight = 0;
+
+    // Optional downsampled export, 0 keeps the aspect ratio
+    std::string m_exportPath;
+    uint32_t m_exportWidth = 0;
+    uint32_t m_exportHeight = 0;
 };
 
 #endif // APPLICATION_HH
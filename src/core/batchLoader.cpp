@@ -0,0 +1,626 @@
+#include "batchLoader.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <thread>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Requests kept in the ring, also bounds the number of open files
+constexpr unsigned int s_queueDepth = 64;
+// Largest single read request
+constexpr size_t s_maxReadSize = 1 << 30;
+// Opcodes asked about when probing the ring
+constexpr unsigned int s_probeOps = 256;
+// Threads doing blocking I/O when io_uring is not there
+constexpr unsigned int s_readThreads = 16;
+
+//------------------------------------------------------------------------------
+// Decodes files on worker threads and keeps track of the bytes in flight
+class DecodePool
+{
+public:
+    DecodePool(const std::vector<std::string>& paths, std::vector<ImageData>& results,
+               size_t maxBytesInFlight);
+    ~DecodePool();
+
+    // Blocks until size more bytes fit, always admits when nothing is in flight
+    void reserve(size_t size);
+    bool tryReserve(size_t size);
+
+    // Hands a completely read file over for decoding
+    void decode(size_t index, std::unique_ptr<char[]> buffer, size_t size);
+    // The file could not be read, its reserved bytes are given back
+    void fail(size_t index, size_t reserved, const std::string& msg);
+    // Gives back bytes reserved for a file that is read again later
+    void release(size_t size);
+
+private:
+    struct Job
+    {
+        size_t index;
+        std::unique_ptr<char[]> buffer;
+        size_t size;
+    };
+
+    void worker();
+
+private:
+    const std::vector<std::string>& m_paths;
+    std::vector<ImageData>& m_results;
+    const size_t m_maxBytesInFlight;
+
+    std::mutex m_mutex;
+    std::condition_variable m_jobReady;
+    std::condition_variable m_bytesFreed;
+    std::deque<Job> m_jobs;
+    size_t m_bytesInFlight = 0;
+    bool m_done = false;
+
+    std::vector<std::thread> m_workers;
+};
+
+// Memory shared with the kernel for one io_uring instance
+struct Ring
+{
+    int fd = -1;
+
+    unsigned int* sqHead;
+    unsigned int* sqTail;
+    unsigned int* sqMask;
+    unsigned int* sqArray;
+    io_uring_sqe* sqes;
+    // Tail of the SQEs filled in so far, the kernel only sees them once
+    // submitAndWait publishes it
+    unsigned int sqeTail = 0;
+    unsigned int toSubmit = 0;
+
+    unsigned int* cqHead;
+    unsigned int* cqTail;
+    unsigned int* cqMask;
+    io_uring_cqe* cqes;
+
+    void* sqRing = MAP_FAILED;
+    size_t sqRingSize = 0;
+    void* cqRing = MAP_FAILED;
+    size_t cqRingSize = 0;
+    size_t sqesSize = 0;
+};
+
+// A file on its way through open -> read -> decode
+struct FileRead
+{
+    enum class State { Opening, Opened, Reading, Done } state = State::Opening;
+    size_t index = 0;
+    int fd = -1;
+    std::unique_ptr<char[]> buffer;
+    size_t size = 0;
+    size_t offset = 0;
+};
+
+//------------------------------------------------------------------------------
+bool loadWithIoUring(const std::vector<std::string>& paths, DecodePool& pool);
+void loadWithThreads(const std::vector<std::string>& paths,
+                     const std::vector<size_t>& indices, DecodePool& pool);
+
+bool setupRing(Ring& ring, unsigned int entries);
+void closeRing(Ring& ring);
+io_uring_sqe* getSqe(Ring& ring);
+int submitAndWait(Ring& ring, unsigned int waitCount);
+void queueRead(Ring& ring, FileRead& file);
+
+//------------------------------------------------------------------------------
+std::vector<ImageData> loadImages(const std::vector<std::string>& paths,
+                                  size_t maxBytesInFlight)
+{
+    std::vector<ImageData> results(paths.size());
+    if (paths.empty()) return results;
+
+    {
+        DecodePool pool(paths, results, maxBytesInFlight);
+        if (!loadWithIoUring(paths, pool))
+        {
+            std::vector<size_t> indices(paths.size());
+            std::iota(indices.begin(), indices.end(), 0);
+            loadWithThreads(paths, indices, pool);
+        }
+        // The pool finishes the remaining decodes when it goes out of scope
+    }
+
+    return results;
+}
+
+//------------------------------------------------------------------------------
+// io_uring path
+bool loadWithIoUring(const std::vector<std::string>& paths, DecodePool& pool)
+{
+    Ring ring;
+    if (!setupRing(ring, s_queueDepth)) return false;
+
+    std::vector<FileRead> files(paths.size());
+    std::deque<FileRead*> opened; // waiting for room in the byte budget
+    size_t nextPath = 0;
+    unsigned int inFlight = 0;
+    bool ringBroken = false;
+
+    while (!ringBroken && (nextPath < paths.size() || inFlight > 0 || !opened.empty()))
+    {
+        // Start reading opened files as long as the budget allows. With
+        // nothing in flight there is nothing else to wait for, so block.
+        while (!opened.empty() && inFlight < s_queueDepth)
+        {
+            FileRead* file = opened.front();
+            if (!pool.tryReserve(file->size))
+            {
+                if (inFlight > 0) break;
+                pool.reserve(file->size);
+            }
+            opened.pop_front();
+
+            // Nothing to read, the decoder reports the empty file
+            if (file->size == 0)
+            {
+                ::close(file->fd);
+                file->state = FileRead::State::Done;
+                pool.decode(file->index, nullptr, 0);
+                continue;
+            }
+
+            file->state = FileRead::State::Reading;
+            file->buffer.reset(new char[file->size]);
+            queueRead(ring, *file);
+            inFlight++;
+        }
+
+        // Open more files, opened files count against the queue depth so
+        // the number of descriptors stays bounded
+        while (nextPath < paths.size() && inFlight + opened.size() < s_queueDepth)
+        {
+            FileRead& file = files[nextPath];
+            file.index = nextPath;
+
+            io_uring_sqe* sqe = getSqe(ring);
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = reinterpret_cast<uint64_t>(paths[nextPath].c_str());
+            sqe->open_flags = O_RDONLY | O_CLOEXEC;
+            sqe->user_data = reinterpret_cast<uint64_t>(&file);
+
+            nextPath++;
+            inFlight++;
+        }
+
+        if (inFlight == 0) continue;
+
+        if (submitAndWait(ring, 1) < 0)
+        {
+            ringBroken = true;
+            break;
+        }
+
+        // Reap completions
+        unsigned int head = *ring.cqHead;
+        unsigned int tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++)
+        {
+            const io_uring_cqe& cqe = ring.cqes[head & *ring.cqMask];
+            FileRead& file = *reinterpret_cast<FileRead*>(cqe.user_data);
+            inFlight--;
+
+            if (file.state == FileRead::State::Opening)
+            {
+                struct stat info;
+                if (cqe.res < 0)
+                {
+                    file.state = FileRead::State::Done;
+                    pool.fail(file.index, 0, paths[file.index] + " could not be opened!");
+                }
+                else if (::fstat(cqe.res, &info) != 0)
+                {
+                    ::close(cqe.res);
+                    file.state = FileRead::State::Done;
+                    pool.fail(file.index, 0, paths[file.index] + " could not be opened!");
+                }
+                else
+                {
+                    file.fd = cqe.res;
+                    file.size = static_cast<size_t>(info.st_size);
+                    file.state = FileRead::State::Opened;
+                    opened.push_back(&file);
+                }
+                continue;
+            }
+
+            if (cqe.res <= 0)
+            {
+                // A zero length read means the file got shorter meanwhile
+                ::close(file.fd);
+                file.buffer.reset();
+                file.state = FileRead::State::Done;
+                pool.fail(file.index, file.size, "Error: could only read "
+                          + std::to_string(file.offset) + " of "
+                          + std::to_string(file.size) + " bytes!");
+                continue;
+            }
+
+            file.offset += static_cast<size_t>(cqe.res);
+            if (file.offset < file.size)
+            {
+                queueRead(ring, file);
+                inFlight++;
+                continue;
+            }
+
+            ::close(file.fd);
+            file.state = FileRead::State::Done;
+            pool.decode(file.index, std::move(file.buffer), file.size);
+        }
+        __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    if (ringBroken)
+    {
+        // Whatever completed already gives its descriptor or buffer back.
+        // Requests still in the kernel can complete after the ring is gone:
+        // their buffers are leaked rather than freed, and an open that
+        // completes that late leaks its descriptor
+        unsigned int head = *ring.cqHead;
+        unsigned int tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++)
+        {
+            const io_uring_cqe& cqe = ring.cqes[head & *ring.cqMask];
+            FileRead& file = *reinterpret_cast<FileRead*>(cqe.user_data);
+
+            if (file.state == FileRead::State::Opening && cqe.res >= 0)
+                ::close(cqe.res);
+            else if (file.state == FileRead::State::Reading)
+                file.buffer.reset();
+        }
+        __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    closeRing(ring);
+
+    if (ringBroken)
+    {
+        // Files the ring didn't finish are read again by the threads
+        std::vector<size_t> remaining;
+        for (size_t it = 0; it < paths.size(); it++)
+        {
+            FileRead& file = files[it];
+            if (file.state == FileRead::State::Done) continue;
+
+            if (file.state == FileRead::State::Reading)
+            {
+                file.buffer.release();
+                pool.release(file.size);
+            }
+            if (file.fd >= 0)
+                ::close(file.fd);
+
+            remaining.push_back(it);
+        }
+
+        loadWithThreads(paths, remaining, pool);
+    }
+
+    return true;
+}
+
+bool setupRing(Ring& ring, unsigned int entries)
+{
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+
+    int fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+    if (fd < 0) return false;
+    ring.fd = fd;
+
+    // OPENAT and READ came with 5.6, older kernels only fail them in the
+    // completion. The probe came with 5.6 too, so a failing probe also
+    // means the opcodes are missing
+    std::vector<uint64_t> probeMemory((sizeof(io_uring_probe)
+                                       + s_probeOps * sizeof(io_uring_probe_op))
+                                      / sizeof(uint64_t) + 1);
+    io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(probeMemory.data());
+    if (::syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, s_probeOps) < 0
+        || probe->last_op < IORING_OP_READ
+        || !(probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED)
+        || !(probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED))
+    {
+        closeRing(ring);
+        return false;
+    }
+
+    ring.sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring.cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+    // Newer kernels map both rings with a single mmap
+    bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMmap)
+    {
+        ring.sqRingSize = std::max(ring.sqRingSize, ring.cqRingSize);
+        ring.cqRingSize = ring.sqRingSize;
+    }
+
+    ring.sqRing = ::mmap(nullptr, ring.sqRingSize, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring.sqRing == MAP_FAILED)
+    {
+        closeRing(ring);
+        return false;
+    }
+
+    if (singleMmap)
+    {
+        ring.cqRing = ring.sqRing;
+    }
+    else
+    {
+        ring.cqRing = ::mmap(nullptr, ring.cqRingSize, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring.cqRing == MAP_FAILED)
+        {
+            closeRing(ring);
+            return false;
+        }
+    }
+
+    ring.sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = ::mmap(nullptr, ring.sqesSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        ring.sqesSize = 0;
+        closeRing(ring);
+        return false;
+    }
+    ring.sqes = static_cast<io_uring_sqe*>(sqes);
+
+    char* sq = static_cast<char*>(ring.sqRing);
+    ring.sqHead = reinterpret_cast<unsigned int*>(sq + params.sq_off.head);
+    ring.sqTail = reinterpret_cast<unsigned int*>(sq + params.sq_off.tail);
+    ring.sqMask = reinterpret_cast<unsigned int*>(sq + params.sq_off.ring_mask);
+    ring.sqArray = reinterpret_cast<unsigned int*>(sq + params.sq_off.array);
+    ring.sqeTail = *ring.sqTail;
+
+    char* cq = static_cast<char*>(ring.cqRing);
+    ring.cqHead = reinterpret_cast<unsigned int*>(cq + params.cq_off.head);
+    ring.cqTail = reinterpret_cast<unsigned int*>(cq + params.cq_off.tail);
+    ring.cqMask = reinterpret_cast<unsigned int*>(cq + params.cq_off.ring_mask);
+    ring.cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    return true;
+}
+
+void closeRing(Ring& ring)
+{
+    if (ring.sqesSize > 0)
+        ::munmap(ring.sqes, ring.sqesSize);
+    if (ring.cqRing != MAP_FAILED && ring.cqRing != ring.sqRing)
+        ::munmap(ring.cqRing, ring.cqRingSize);
+    if (ring.sqRing != MAP_FAILED)
+        ::munmap(ring.sqRing, ring.sqRingSize);
+    if (ring.fd >= 0)
+        ::close(ring.fd);
+
+    ring = Ring();
+}
+
+// Never runs out, the callers keep at most s_queueDepth requests in flight.
+// The SQE is filled in by the caller and submitted with the next submitAndWait
+io_uring_sqe* getSqe(Ring& ring)
+{
+    unsigned int index = ring.sqeTail & *ring.sqMask;
+
+    io_uring_sqe* sqe = &ring.sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    ring.sqArray[index] = index;
+    ring.sqeTail++;
+
+    return sqe;
+}
+
+int submitAndWait(Ring& ring, unsigned int waitCount)
+{
+    // Publish all SQEs filled in since the last call at once, like
+    // io_uring_submit() does. Only this thread writes the tail
+    ring.toSubmit += ring.sqeTail - *ring.sqTail;
+    __atomic_store_n(ring.sqTail, ring.sqeTail, __ATOMIC_RELEASE);
+
+    while (true)
+    {
+        int result = static_cast<int>(::syscall(__NR_io_uring_enter, ring.fd, ring.toSubmit,
+                                                waitCount, IORING_ENTER_GETEVENTS,
+                                                nullptr, 0));
+        if (result >= 0)
+        {
+            ring.toSubmit -= std::min<unsigned int>(ring.toSubmit, result);
+            return result;
+        }
+
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            return -1;
+    }
+}
+
+void queueRead(Ring& ring, FileRead& file)
+{
+    io_uring_sqe* sqe = getSqe(ring);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = file.fd;
+    sqe->addr = reinterpret_cast<uint64_t>(file.buffer.get() + file.offset);
+    sqe->len = static_cast<uint32_t>(std::min(file.size - file.offset, s_maxReadSize));
+    sqe->off = file.offset;
+    sqe->user_data = reinterpret_cast<uint64_t>(&file);
+}
+
+//------------------------------------------------------------------------------
+// Fallback, blocking reads on a pool of threads
+void loadWithThreads(const std::vector<std::string>& paths,
+                     const std::vector<size_t>& indices, DecodePool& pool)
+{
+    std::atomic<size_t> nextIndex = 0;
+
+    auto reader = [&]()
+    {
+        for (size_t next = nextIndex++; next < indices.size(); next = nextIndex++)
+        {
+            size_t it = indices[next];
+            int fd = ::open(paths[it].c_str(), O_RDONLY | O_CLOEXEC);
+            struct stat info;
+            if (fd < 0 || ::fstat(fd, &info) != 0)
+            {
+                if (fd >= 0) ::close(fd);
+                pool.fail(it, 0, paths[it] + " could not be opened!");
+                continue;
+            }
+
+            size_t size = static_cast<size_t>(info.st_size);
+            pool.reserve(size);
+            std::unique_ptr<char[]> buffer(new char[size]);
+
+            size_t offset = 0;
+            while (offset < size)
+            {
+                ssize_t count = ::pread(fd, buffer.get() + offset,
+                                        std::min(size - offset, s_maxReadSize), offset);
+                if (count < 0 && errno == EINTR) continue;
+                if (count <= 0) break;
+                offset += static_cast<size_t>(count);
+            }
+            ::close(fd);
+
+            if (offset < size)
+            {
+                pool.fail(it, size, "Error: could only read " + std::to_string(offset)
+                          + " of " + std::to_string(size) + " bytes!");
+                continue;
+            }
+
+            pool.decode(it, std::move(buffer), size);
+        }
+    };
+
+    size_t threadCount = std::min<size_t>(indices.size(), s_readThreads);
+    std::vector<std::thread> threads;
+    for (size_t it = 0; it < threadCount; it++)
+    {
+        threads.emplace_back(reader);
+    }
+
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+//------------------------------------------------------------------------------
+DecodePool::DecodePool(const std::vector<std::string>& paths,
+                       std::vector<ImageData>& results, size_t maxBytesInFlight):
+    m_paths(paths),
+    m_results(results),
+    m_maxBytesInFlight(maxBytesInFlight)
+{
+    unsigned int threadCount = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned int it = 0; it < threadCount; it++)
+    {
+        m_workers.emplace_back(&DecodePool::worker, this);
+    }
+}
+
+DecodePool::~DecodePool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done = true;
+    }
+    m_jobReady.notify_all();
+
+    for (std::thread& thread : m_workers)
+    {
+        thread.join();
+    }
+}
+
+void DecodePool::reserve(size_t size)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_bytesFreed.wait(lock, [&]()
+    {
+        return m_bytesInFlight == 0 || m_bytesInFlight + size <= m_maxBytesInFlight;
+    });
+    m_bytesInFlight += size;
+}
+
+bool DecodePool::tryReserve(size_t size)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_bytesInFlight != 0 && m_bytesInFlight + size > m_maxBytesInFlight)
+        return false;
+
+    m_bytesInFlight += size;
+    return true;
+}
+
+void DecodePool::decode(size_t index, std::unique_ptr<char[]> buffer, size_t size)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back(Job{index, std::move(buffer), size});
+    }
+    m_jobReady.notify_one();
+}
+
+void DecodePool::fail(size_t index, size_t reserved, const std::string& msg)
+{
+    m_results[index].exceptionMsg = msg;
+    release(reserved);
+}
+
+void DecodePool::release(size_t size)
+{
+    if (size == 0) return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bytesInFlight -= size;
+    }
+    m_bytesFreed.notify_all();
+}
+
+void DecodePool::worker()
+{
+    while (true)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_jobReady.wait(lock, [&]() { return m_done || !m_jobs.empty(); });
+            if (m_jobs.empty()) return;
+
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+
+        if (!hasPPMextension(m_paths[job.index]))
+            m_results[job.index].exceptionMsg = "Invalid file: " + m_paths[job.index];
+        else
+            decodeImageBuffer(m_paths[job.index], job.buffer.get(), job.size,
+                              m_results[job.index]);
+
+        job.buffer.reset();
+        release(job.size);
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef BATCH_LOADER_HH
+#define BATCH_LOADER_HH
+
+/*
+ * Loads many images at once
+ *
+ * Opens and reads are queued through io_uring, so many of them are in
+ * flight at the same time. Where io_uring is not available (old kernels,
+ * sandboxes that filter it) a pool of threads does blocking pread()s
+ * instead.
+ *
+ * Every file is decoded on a worker as soon as its read completes. File
+ * buffers count against maxBytesInFlight until their decode finishes, a
+ * file larger than the limit is still loaded, just on its own.
+ */
+
+#include "PPMImage.hh"
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// result[i] belongs to paths[i], failed ones carry their exceptionMsg
+std::vector<ImageData> loadImages(const std::vector<std::string>& paths,
+                                  size_t maxBytesInFlight = 256 * 1024 * 1024);
+
+#endif // BATCH_LOADER_HH
@@ -0,0 +1,354 @@
+#include "decompressor.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// next_in is const with ZLIB_CONST
+#define ZLIB_CONST
+#include <zlib.h>
+#ifdef PPM_HAS_ZSTD
+#include <zstd.h>
+#endif
+
+// Size of the decompressed chunks handed to the decoder
+constexpr size_t s_chunkSize = 1024 * 1024;
+// Chunks decompressed ahead of the decoder, bounds the memory in use
+constexpr size_t s_maxQueuedChunks = 4;
+// Compressed bytes read from the file at a time
+constexpr size_t s_inputSize = 256 * 1024;
+
+const std::string s_gzipSuffix = ".gz";
+const std::string s_zstdSuffix = ".zst";
+
+//------------------------------------------------------------------------------
+Compression getCompression(const std::string& fileName)
+{
+    for (Compression compression : {Compression::Gzip, Compression::Zstd})
+    {
+        std::string_view suffix = compressionSuffix(compression);
+        if (!suffix.empty() && fileName.length() > suffix.length()
+            && fileName.compare(fileName.length() - suffix.length(),
+                                suffix.length(), suffix) == 0)
+        {
+            return compression;
+        }
+    }
+
+    return Compression::None;
+}
+
+std::string_view compressionSuffix(Compression compression)
+{
+    switch (compression)
+    {
+        case Compression::Gzip:
+            return s_gzipSuffix;
+
+        case Compression::Zstd:
+#ifdef PPM_HAS_ZSTD
+            return s_zstdSuffix;
+#else
+            return {};
+#endif
+
+        case Compression::None:
+            break;
+    }
+
+    return {};
+}
+
+//------------------------------------------------------------------------------
+Decompressor::Decompressor(const std::string& fileName, Compression compression)
+    : m_fileName(fileName)
+    , m_compression(compression)
+{
+    m_thread = std::thread(&Decompressor::run, this);
+}
+
+Decompressor::Decompressor(const char* buffer, size_t size, Compression compression)
+    : m_compression(compression)
+    , m_buffer(buffer)
+    , m_bufferSize(size)
+{
+    m_thread = std::thread(&Decompressor::run, this);
+}
+
+Decompressor::~Decompressor()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cancelled = true;
+    }
+    m_chunkTaken.notify_all();
+
+    m_thread.join();
+}
+
+bool Decompressor::next(std::string& chunk)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (chunk.capacity() > 0)
+        m_spare.push_back(std::move(chunk));
+    chunk.clear();
+
+    m_chunkReady.wait(lock, [&]() { return m_finished || !m_chunks.empty(); });
+    if (m_chunks.empty()) return false;
+
+    chunk = std::move(m_chunks.front());
+    m_chunks.pop_front();
+    m_chunkTaken.notify_one();
+
+    return true;
+}
+
+std::string Decompressor::error()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_error;
+}
+
+//------------------------------------------------------------------------------
+void Decompressor::run()
+{
+    if (!m_fileName.empty())
+    {
+        m_fd = ::open(m_fileName.c_str(), O_RDONLY | O_CLOEXEC);
+        if (m_fd < 0)
+        {
+            finish(m_fileName + " could not be opened!");
+            return;
+        }
+
+        ::posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        m_input.resize(s_inputSize);
+    }
+
+    if (m_compression == Compression::Gzip)
+        inflateGzip();
+    else
+        decompressZstd();
+
+    if (m_fd >= 0)
+        ::close(m_fd);
+}
+
+// Returns false at the end of the input, errors are left for finish()
+bool Decompressor::readInput(const char*& data, size_t& size)
+{
+    if (m_fd < 0)
+    {
+        data = m_buffer;
+        size = m_bufferSize;
+        m_bufferSize = 0;
+        return size > 0;
+    }
+
+    ssize_t bytesRead;
+    do
+    {
+        bytesRead = ::read(m_fd, m_input.data(), m_input.size());
+    } while (bytesRead < 0 && errno == EINTR);
+
+    data = m_input.data();
+    size = bytesRead > 0 ? bytesRead : 0;
+    if (bytesRead < 0)
+    {
+        m_readError = "Error: could not read " + m_fileName;
+        return false;
+    }
+
+    return size > 0;
+}
+
+// Concatenated gzip members are decompressed one after another, like gzip -d
+void Decompressor::inflateGzip()
+{
+    z_stream stream = {};
+    if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK)
+    {
+        finish("Error: could not set up zlib");
+        return;
+    }
+
+    std::string chunk(s_chunkSize, '\0');
+    stream.next_out = reinterpret_cast<Bytef*>(chunk.data());
+    stream.avail_out = chunk.size();
+
+    // A full chunk can leave output behind in zlib even when all input
+    // was consumed
+    bool flushPending = false;
+    bool memberEnded = false;
+    bool success = true;
+    bool cancelled = false;
+    while (true)
+    {
+        const char* input;
+        size_t inputSize;
+        if (stream.avail_in == 0 && readInput(input, inputSize))
+        {
+            // Buffers passed in by the caller can be larger than uInt
+            stream.next_in = reinterpret_cast<const Bytef*>(input);
+            stream.avail_in = std::min<size_t>(inputSize, UINT32_MAX);
+            if (inputSize > stream.avail_in)
+            {
+                m_buffer = input + stream.avail_in;
+                m_bufferSize = inputSize - stream.avail_in;
+            }
+        }
+        else if (stream.avail_in == 0 && !flushPending)
+        {
+            break;
+        }
+
+        if (memberEnded)
+        {
+            inflateReset(&stream);
+            memberEnded = false;
+        }
+
+        int result = inflate(&stream, Z_NO_FLUSH);
+        if (result == Z_STREAM_END)
+        {
+            memberEnded = true;
+        }
+        else if (result != Z_OK && result != Z_BUF_ERROR)
+        {
+            success = false;
+            break;
+        }
+
+        flushPending = stream.avail_out == 0 && !memberEnded;
+        if (stream.avail_out == 0)
+        {
+            if (!push(chunk))
+            {
+                cancelled = true;
+                break;
+            }
+            stream.next_out = reinterpret_cast<Bytef*>(chunk.data());
+            stream.avail_out = chunk.size();
+        }
+    }
+
+    chunk.resize(chunk.size() - stream.avail_out);
+    inflateEnd(&stream);
+
+    if (cancelled)
+        return;
+
+    if (!m_readError.empty())
+        finish(m_readError);
+    else if (!success || !memberEnded)
+        finish("Compressed data invalid or truncated");
+    else if (chunk.empty() || push(chunk))
+        finish("");
+}
+
+#ifdef PPM_HAS_ZSTD
+void Decompressor::decompressZstd()
+{
+    ZSTD_DStream* stream = ZSTD_createDStream();
+    if (!stream)
+    {
+        finish("Error: could not set up zstd");
+        return;
+    }
+
+    std::string chunk(s_chunkSize, '\0');
+    ZSTD_outBuffer output = {chunk.data(), chunk.size(), 0};
+    ZSTD_inBuffer input = {nullptr, 0, 0};
+
+    // Zero once a frame is complete, frames can follow each other
+    size_t remaining = 1;
+    bool flushPending = false;
+    bool success = true;
+    bool cancelled = false;
+    while (true)
+    {
+        const char* data;
+        size_t size;
+        if (input.pos == input.size && readInput(data, size))
+        {
+            input = {data, size, 0};
+        }
+        else if (input.pos == input.size && !flushPending)
+        {
+            break;
+        }
+
+        remaining = ZSTD_decompressStream(stream, &output, &input);
+        if (ZSTD_isError(remaining))
+        {
+            success = false;
+            break;
+        }
+
+        flushPending = output.pos == output.size && remaining != 0;
+        if (output.pos == output.size)
+        {
+            if (!push(chunk))
+            {
+                cancelled = true;
+                break;
+            }
+            output = {chunk.data(), chunk.size(), 0};
+        }
+    }
+
+    chunk.resize(output.pos);
+    ZSTD_freeDStream(stream);
+
+    if (cancelled)
+        return;
+
+    if (!m_readError.empty())
+        finish(m_readError);
+    else if (!success || remaining != 0)
+        finish("Compressed data invalid or truncated");
+    else if (chunk.empty() || push(chunk))
+        finish("");
+}
+#else
+void Decompressor::decompressZstd()
+{
+    finish("Error: built without zstd support");
+}
+#endif
+
+//------------------------------------------------------------------------------
+bool Decompressor::push(std::string& chunk)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_chunkTaken.wait(lock, [&]()
+    {
+        return m_cancelled || m_chunks.size() < s_maxQueuedChunks;
+    });
+    if (m_cancelled) return false;
+
+    m_chunks.push_back(std::move(chunk));
+    m_chunkReady.notify_one();
+
+    if (!m_spare.empty())
+    {
+        chunk = std::move(m_spare.back());
+        m_spare.pop_back();
+    }
+    chunk.resize(s_chunkSize);
+
+    return true;
+}
+
+void Decompressor::finish(const std::string& error)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_error = error;
+        m_finished = true;
+    }
+    m_chunkReady.notify_all();
+}
@@ -0,0 +1,87 @@
+#ifndef DECOMPRESSOR_HH
+#define DECOMPRESSOR_HH
+
+/*
+ * Decompresses .ppm.gz and .ppm.zst images on the fly
+ *
+ * The input is decompressed on a thread of its own into chunks that are
+ * handed to the decoder through a short queue. Decompression and parsing
+ * overlap, and the uncompressed image only ever exists as the few chunks
+ * in the queue. zstd is only supported when it was found at build time
+ * (PPM_HAS_ZSTD).
+ */
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <cstddef>
+
+enum class Compression
+{
+    None = 0,
+    Gzip,
+    Zstd
+};
+
+// Goes by the extension, ".gz" or ".zst"
+Compression getCompression(const std::string& fileName);
+std::string_view compressionSuffix(Compression compression);
+
+class Decompressor
+{
+public:
+    // Reads and decompresses the file
+    Decompressor(const std::string& fileName, Compression compression);
+    // Decompresses a file that was already read, buffer has to outlive this
+    Decompressor(const char* buffer, size_t size, Compression compression);
+    ~Decompressor();
+
+    Decompressor(const Decompressor&) = delete;
+    Decompressor& operator=(const Decompressor&) = delete;
+
+    // Swaps the next chunk into chunk, the buffer passed in is reused for
+    // later chunks. Returns false once all data was handed out or on error
+    bool next(std::string& chunk);
+
+    // Empty unless the input could not be read or decompressed. Final once
+    // next() returned false
+    std::string error();
+
+private:
+    void run();
+    bool readInput(const char*& data, size_t& size);
+    void inflateGzip();
+    void decompressZstd();
+
+    // Queues a full chunk and gets an empty one, false if the reader is gone
+    bool push(std::string& chunk);
+    void finish(const std::string& error);
+
+private:
+    const std::string m_fileName;
+    const Compression m_compression;
+
+    // Either a file descriptor or a buffer is read
+    int m_fd = -1;
+    const char* m_buffer = nullptr;
+    size_t m_bufferSize = 0;
+    std::vector<char> m_input;
+    std::string m_readError;
+
+    std::mutex m_mutex;
+    std::condition_variable m_chunkReady;
+    std::condition_variable m_chunkTaken;
+    std::deque<std::string> m_chunks;
+    std::vector<std::string> m_spare;
+    std::string m_error;
+    bool m_finished = false;
+    bool m_cancelled = false;
+
+    std::thread m_thread;
+};
+
+#endif // DECOMPRESSOR_HH
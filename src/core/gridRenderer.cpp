@@ -0,0 +1,262 @@
+#include "gridRenderer.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <cstdint>
+
+const std::string s_gridShaderPath = "/shader/grid.shader";
+
+// Side of one atlas layer in texels
+constexpr uint32_t s_atlasSize = 2048;
+// Space between thumbnails on screen
+constexpr float s_cellPadding = 8.0f;
+// Pixels scrolled per mouse wheel step
+constexpr float s_scrollStep = 64.0f;
+
+struct ThumbnailInstance
+{
+    float texRect[4];
+    float layer;
+    float extent[2];
+};
+
+GridRenderer::GridRenderer(std::vector<ImageData> thumbnails, uint32_t thumbnailSize,
+                           const std::string& title):
+    m_title(title),
+    m_thumbnails(std::move(thumbnails)),
+    m_thumbnailSize(std::clamp<uint32_t>(thumbnailSize, 1, s_atlasSize))
+{
+    m_cellsPerSide = s_atlasSize / m_thumbnailSize;
+}
+GridRenderer::~GridRenderer() {}
+
+void GridRenderer::run()
+{
+    if (!initGLFW())
+    {
+        return;
+    }
+
+    renderSetup();
+    Shader shader(s_gridShaderPath);
+    renderLoop(shader);
+}
+
+void GridRenderer::renderLoop(Shader& shader)
+{
+    const int thumbnailCount = static_cast<int>(m_thumbnails.size());
+    const float cellSize = m_thumbnailSize + s_cellPadding;
+
+    while (!glfwWindowShouldClose(m_window))
+    {
+        glClearColor(0.15f, 0.15f, 0.15f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        int columns = std::max(1, static_cast<int>(m_windowWidth / cellSize));
+        int rows = (thumbnailCount + columns - 1) / columns;
+
+        float maxScroll = std::max(0.0f, rows * cellSize - m_windowHeight);
+        m_scrollOffset = std::clamp(m_scrollOffset, 0.0f, maxScroll);
+
+        // Only the rows that intersect the window are drawn
+        int firstRow = static_cast<int>(m_scrollOffset / cellSize);
+        int lastRow = static_cast<int>(std::ceil((m_scrollOffset + m_windowHeight) / cellSize));
+        int first = firstRow * columns;
+        int count = std::min(thumbnailCount, lastRow * columns) - first;
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, m_atlasId);
+
+        glBindVertexArray(m_VAO);
+
+        shader.bind();
+        shader.setUniform1i("atlas", 0);
+        shader.setUniform2f("viewportSize", m_windowWidth, m_windowHeight);
+        shader.setUniform1f("cellSize", cellSize);
+        shader.setUniform1i("columns", columns);
+        shader.setUniform1f("scrollOffset", m_scrollOffset);
+
+        if (count > 0)
+            glDrawArraysInstancedBaseInstance(GL_TRIANGLES, 0, 6, count, first);
+
+        glfwSwapBuffers(m_window);
+        glfwWaitEvents();
+    }
+
+    // Cleanups
+    glfwTerminate();
+}
+
+bool GridRenderer::initGLFW()
+{
+    if (!glfwInit())
+    {
+        std::cerr << "Failed to initialized GLFW!!!\n";
+        return false;
+    }
+
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+    m_window = glfwCreateWindow(m_windowWidth, m_windowHeight, m_title.c_str(),
+                                nullptr, nullptr);
+
+    if (!m_window)
+    {
+        std::cerr << "Failed to create window!!!\n";
+        glfwTerminate();
+        return false;
+    }
+
+    glfwMakeContextCurrent(m_window);
+
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    {
+        std::cerr << "Failed to load GLAD!!!\n";
+        glfwTerminate();
+        return false;
+    }
+
+    glViewport(0, 0, m_windowWidth, m_windowHeight);
+    glfwSetWindowUserPointer(m_window, this);
+    glfwSetFramebufferSizeCallback(m_window, updateWindowSize);
+    glfwSetScrollCallback(m_window, updateScroll);
+
+    return true;
+}
+
+void GridRenderer::renderSetup()
+{
+    float corners[] =
+    {
+        0.0f, 0.0f,
+        0.0f, 1.0f,
+        1.0f, 1.0f,
+
+        1.0f, 1.0f,
+        1.0f, 0.0f,
+        0.0f, 0.0f
+    };
+
+    glGenVertexArrays(1, &m_VAO);
+    glBindVertexArray(m_VAO);
+
+    glGenBuffers(1, &m_VBO);
+    glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+
+    // Corner
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+
+    createAtlas();
+
+    glBindVertexArray(0);
+}
+
+void GridRenderer::createAtlas()
+{
+    const uint32_t cellsPerLayer = m_cellsPerSide * m_cellsPerSide;
+    const uint32_t layerCount = std::max<uint32_t>(
+        1, (m_thumbnails.size() + cellsPerLayer - 1) / cellsPerLayer);
+
+    glGenTextures(1, &m_atlasId);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_atlasId);
+
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGB8, s_atlasSize, s_atlasSize, layerCount);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    std::vector<ThumbnailInstance> instances(m_thumbnails.size());
+    std::vector<uint8_t> buffer;
+
+    for (size_t it = 0; it < m_thumbnails.size(); it++)
+    {
+        const ImageData& thumbnail = m_thumbnails[it];
+        ThumbnailInstance& instance = instances[it];
+
+        uint32_t layer = it / cellsPerLayer;
+        uint32_t cell = it % cellsPerLayer;
+        uint32_t cellX = (cell % m_cellsPerSide) * m_thumbnailSize;
+        uint32_t cellY = (cell / m_cellsPerSide) * m_thumbnailSize;
+
+        // Images that failed to load stay as empty cells
+        if (!thumbnail.isValid() || thumbnail.pixelData.empty())
+        {
+            instance = ThumbnailInstance{};
+            continue;
+        }
+
+        uint32_t width = std::min(thumbnail.imageWidth, m_thumbnailSize);
+        uint32_t height = std::min(thumbnail.imageHeight, m_thumbnailSize);
+
+        // The atlas is 8-bit, 16-bit thumbnails keep their high byte
+        int shift = thumbnail.maxColorValue <= 255 ? 0 : 8;
+        buffer.resize(static_cast<size_t>(width) * height * 3);
+        for (uint32_t row = 0; row < height; row++)
+        {
+            const uint16_t* src = thumbnail.pixelData.data()
+                                  + static_cast<size_t>(row) * thumbnail.imageWidth * 3;
+            uint8_t* dst = buffer.data() + static_cast<size_t>(row) * width * 3;
+            for (uint32_t sample = 0; sample < width * 3; sample++)
+            {
+                dst[sample] = static_cast<uint8_t>(src[sample] >> shift);
+            }
+        }
+
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, cellX, cellY, layer,
+                        width, height, 1, GL_RGB, GL_UNSIGNED_BYTE, buffer.data());
+
+        // Inset by half a texel so filtering never reaches the neighbour cell
+        instance.texRect[0] = (cellX + 0.5f) / s_atlasSize;
+        instance.texRect[1] = (cellY + 0.5f) / s_atlasSize;
+        instance.texRect[2] = (cellX + width - 0.5f) / s_atlasSize;
+        instance.texRect[3] = (cellY + height - 0.5f) / s_atlasSize;
+        instance.layer = static_cast<float>(layer);
+        instance.extent[0] = static_cast<float>(width);
+        instance.extent[1] = static_cast<float>(height);
+    }
+
+    glGenBuffers(1, &m_instanceVBO);
+    glBindBuffer(GL_ARRAY_BUFFER, m_instanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(ThumbnailInstance),
+                 instances.data(), GL_STATIC_DRAW);
+
+    // Texture rectangle
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(ThumbnailInstance),
+                          (void*)offsetof(ThumbnailInstance, texRect));
+    glVertexAttribDivisor(1, 1);
+    // Atlas layer
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(ThumbnailInstance),
+                          (void*)offsetof(ThumbnailInstance, layer));
+    glVertexAttribDivisor(2, 1);
+    // Thumbnail size
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(ThumbnailInstance),
+                          (void*)offsetof(ThumbnailInstance, extent));
+    glVertexAttribDivisor(3, 1);
+}
+
+void GridRenderer::updateWindowSize(GLFWwindow* window, int width, int height)
+{
+    GridRenderer* renderer = static_cast<GridRenderer*>(glfwGetWindowUserPointer(window));
+    renderer->m_windowWidth = std::max(1, width);
+    renderer->m_windowHeight = std::max(1, height);
+
+    glViewport(0, 0, width, height);
+}
+
+void GridRenderer::updateScroll(GLFWwindow* window, double, double yOffset)
+{
+    GridRenderer* renderer = static_cast<GridRenderer*>(glfwGetWindowUserPointer(window));
+    renderer->m_scrollOffset -= static_cast<float>(yOffset) * s_scrollStep;
+}
@@ -0,0 +1,59 @@
+#ifndef GRID_RENDERER_HH
+#define GRID_RENDERER_HH
+
+/*
+ * Contact sheet of many thumbnails
+ *
+ * All thumbnails are packed into the layers of one array texture (the
+ * atlas), a layer holds a grid of thumbnailSize cells. Every thumbnail is
+ * an instance with its atlas rectangle, so the visible rows of the grid are
+ * drawn with a single instanced draw call.
+ */
+
+#include "PPMImage.hh"
+#include "Shader.hh"
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <string>
+#include <vector>
+
+class GridRenderer
+{
+public:
+    GridRenderer(std::vector<ImageData> thumbnails, uint32_t thumbnailSize,
+                 const std::string& title);
+    ~GridRenderer();
+
+    void run();
+private:
+    bool initGLFW();
+    void renderSetup();
+    void createAtlas();
+    void renderLoop(Shader& shader);
+    static void updateWindowSize(GLFWwindow* window, int width, int height);
+    static void updateScroll(GLFWwindow* window, double xOffset, double yOffset);
+
+private:
+    GLFWwindow* m_window;
+    std::string m_title;
+
+    int m_windowWidth = 1280;
+    int m_windowHeight = 800;
+    float m_scrollOffset = 0.0f;
+
+    std::vector<ImageData> m_thumbnails;
+    uint32_t m_thumbnailSize;
+    uint32_t m_cellsPerSide; // cells along one side of an atlas layer
+
+    // Vertex Buffers
+    unsigned int m_VAO;
+    unsigned int m_VBO;
+    unsigned int m_instanceVBO;
+
+    // Atlas texture ID
+    unsigned int m_atlasId;
+};
+
+#endif // GRID_RENDERER_HH
@@ -0,0 +1,312 @@
+#include "pixelCache.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Version is part of the magic, entries from an older layout never match
+constexpr char s_cacheMagic[8] = {'P', 'P', 'M', 'P', 'I', 'X', '0', '1'};
+const std::string s_entryExtension = ".pix";
+const std::string s_lockName = ".lock";
+
+// Pixels start at this offset, so they are page aligned for any page size
+// up to it
+constexpr size_t s_pixelOffset = 4096;
+constexpr uint64_t s_defaultCacheSize = 2048ull * 1024 * 1024;
+
+// Stored in native byte order, the cache never leaves the machine
+struct CacheHeader
+{
+    char magic[8];
+    uint64_t fileSize;
+    int64_t mtime; // nanoseconds
+    uint64_t contentHash;
+    uint32_t imageWidth;
+    uint32_t imageHeight;
+    uint32_t maxColorValue;
+    uint32_t reserved;
+    uint64_t pixelBytes;
+};
+
+//------------------------------------------------------------------------------
+uint64_t getCacheLimit();
+bool getEntryPath(const std::string& fileName, fs::path& entryPath,
+                  uint64_t& fileSize, int64_t& mtime);
+uint64_t hashBytes(std::string_view bytes);
+void evictEntries(const fs::path& cacheDir, uint64_t limit);
+
+//------------------------------------------------------------------------------
+bool loadCachedPixels(const std::string& fileName, std::string_view content,
+                      ImageData& data)
+{
+    if (getCacheLimit() == 0) return false;
+
+    fs::path entryPath;
+    uint64_t fileSize;
+    int64_t mtime;
+    if (!getEntryPath(fileName, entryPath, fileSize, mtime)) return false;
+
+    int fd = ::open(entryPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    const size_t sampleCount = static_cast<size_t>(data.imageWidth) * data.imageHeight * 3;
+    const size_t pixelBytes = sampleCount * sizeof(uint16_t);
+
+    struct stat info;
+    if (::fstat(fd, &info) != 0
+        || static_cast<size_t>(info.st_size) != s_pixelOffset + pixelBytes)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void* mapping = ::mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED)
+    {
+        ::close(fd);
+        return false;
+    }
+    ::madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+
+    const CacheHeader* header = static_cast<const CacheHeader*>(mapping);
+    bool valid = std::memcmp(header->magic, s_cacheMagic, sizeof(s_cacheMagic)) == 0
+                 && header->fileSize == fileSize && header->mtime == mtime
+                 && header->imageWidth == data.imageWidth
+                 && header->imageHeight == data.imageHeight
+                 && header->maxColorValue == data.maxColorValue
+                 && header->pixelBytes == pixelBytes
+                 && header->contentHash == hashBytes(content);
+
+    if (valid)
+    {
+        data.pixelData.resize(sampleCount);
+        std::memcpy(data.pixelData.data(),
+                    static_cast<const char*>(mapping) + s_pixelOffset, pixelBytes);
+
+        // Recently used entries are the last to be evicted
+        ::futimens(fd, nullptr);
+    }
+
+    ::munmap(mapping, info.st_size);
+    ::close(fd);
+
+    return valid;
+}
+
+void storeCachedPixels(const std::string& fileName, std::string_view content,
+                       const ImageData& data)
+{
+    const uint64_t limit = getCacheLimit();
+    if (limit == 0) return;
+
+    CacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, s_cacheMagic, sizeof(s_cacheMagic));
+    header.contentHash = hashBytes(content);
+    header.imageWidth = data.imageWidth;
+    header.imageHeight = data.imageHeight;
+    header.maxColorValue = data.maxColorValue;
+    header.pixelBytes = data.pixelData.size() * sizeof(uint16_t);
+
+    // Would be evicted right away
+    if (s_pixelOffset + header.pixelBytes > limit) return;
+
+    fs::path entryPath;
+    if (!getEntryPath(fileName, entryPath, header.fileSize, header.mtime)) return;
+
+    std::error_code error;
+    fs::create_directories(entryPath.parent_path(), error);
+
+    // The rename makes the entry appear at once
+    fs::path tempPath = getCacheTempPath(entryPath);
+    {
+        std::ofstream fileObj(tempPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!fileObj) return;
+
+        std::vector<char> headerPage(s_pixelOffset, '\0');
+        std::memcpy(headerPage.data(), &header, sizeof(header));
+        fileObj.write(headerPage.data(), headerPage.size());
+        fileObj.write(reinterpret_cast<const char*>(data.pixelData.data()),
+                      header.pixelBytes);
+
+        if (!fileObj)
+        {
+            fileObj.close();
+            fs::remove(tempPath, error);
+            return;
+        }
+    }
+
+    fs::rename(tempPath, entryPath, error);
+    if (error)
+    {
+        fs::remove(tempPath, error);
+        return;
+    }
+
+    evictEntries(entryPath.parent_path(), limit);
+}
+
+fs::path getCacheDir(const std::string& name)
+{
+    fs::path cacheHome;
+    if (const char* xdgCache = std::getenv("XDG_CACHE_HOME"); xdgCache && *xdgCache)
+        cacheHome = xdgCache;
+    else if (const char* home = std::getenv("HOME"); home && *home)
+        cacheHome = fs::path(home) / ".cache";
+    else
+        cacheHome = fs::temp_directory_path();
+
+    return cacheHome / "ppm-viewer" / name;
+}
+
+fs::path getCacheTempPath(const fs::path& entryPath)
+{
+    // Unique per process and call, several threads may write the same entry
+    static std::atomic<uint32_t> s_tempCounter = 0;
+    return entryPath.string() + "." + std::to_string(::getpid()) + "."
+           + std::to_string(s_tempCounter++) + ".tmp";
+}
+
+//------------------------------------------------------------------------------
+uint64_t getCacheLimit()
+{
+    const char* size = std::getenv("PPM_VIEWER_CACHE_SIZE");
+    if (!size || !*size) return s_defaultCacheSize;
+
+    char* end;
+    unsigned long long megabytes = std::strtoull(size, &end, 10);
+    if (*end != '\0') return s_defaultCacheSize;
+
+    return static_cast<uint64_t>(megabytes) * 1024 * 1024;
+}
+
+// The entry name covers path, size and mtime, the content hash is checked
+// against the header
+bool getEntryPath(const std::string& fileName, fs::path& entryPath,
+                  uint64_t& fileSize, int64_t& mtime)
+{
+    std::error_code error;
+    fs::path canonicalPath = fs::canonical(fileName, error);
+    if (error) return false;
+
+    struct stat info;
+    if (::stat(canonicalPath.c_str(), &info) != 0) return false;
+
+    fileSize = static_cast<uint64_t>(info.st_size);
+    mtime = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000
+            + info.st_mtim.tv_nsec;
+
+    std::string key = canonicalPath.string();
+    key.append(reinterpret_cast<const char*>(&fileSize), sizeof(fileSize));
+    key.append(reinterpret_cast<const char*>(&mtime), sizeof(mtime));
+
+    char name[17];
+    std::snprintf(name, sizeof(name), "%016llx",
+                  static_cast<unsigned long long>(hashBytes(key)));
+
+    entryPath = getCacheDir("pixels") / (std::string(name) + s_entryExtension);
+    return true;
+}
+
+// Not cryptographic, just fast enough to not matter next to P3 parsing
+uint64_t hashBytes(std::string_view bytes)
+{
+    constexpr uint64_t prime = 0x9e3779b97f4a7c15ull;
+
+    auto mix = [](uint64_t value)
+    {
+        value ^= value >> 33;
+        value *= 0xff51afd7ed558ccdull;
+        value ^= value >> 33;
+        value *= 0xc4ceb9fe1a85ec53ull;
+        value ^= value >> 33;
+        return value;
+    };
+
+    uint64_t hash = bytes.size() * prime;
+    size_t it = 0;
+    for (; it + 8 <= bytes.size(); it += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, bytes.data() + it, sizeof(word));
+        hash = (hash ^ (word * prime)) * prime;
+        hash ^= hash >> 31;
+    }
+
+    uint64_t tail = 0;
+    if (it < bytes.size())
+        std::memcpy(&tail, bytes.data() + it, bytes.size() - it);
+
+    return mix(hash ^ tail);
+}
+
+// Removes the least recently used entries until the cache fits the limit.
+// Only one process evicts at a time, the others just skip it.
+void evictEntries(const fs::path& cacheDir, uint64_t limit)
+{
+    std::string lockPath = (cacheDir / s_lockName).string();
+    int lockFd = ::open(lockPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lockFd < 0) return;
+
+    if (::flock(lockFd, LOCK_EX | LOCK_NB) != 0)
+    {
+        ::close(lockFd);
+        return;
+    }
+
+    struct Entry
+    {
+        fs::path path;
+        uint64_t size;
+        fs::file_time_type lastUse;
+    };
+
+    std::vector<Entry> entries;
+    uint64_t totalSize = 0;
+
+    std::error_code error;
+    for (const fs::directory_entry& dirEntry : fs::directory_iterator(cacheDir, error))
+    {
+        // Temporary files of a crashed writer age out like everything else
+        const fs::path& path = dirEntry.path();
+        if (path.filename() == s_lockName || !dirEntry.is_regular_file(error))
+            continue;
+
+        Entry entry{path, dirEntry.file_size(error), dirEntry.last_write_time(error)};
+        if (error) continue;
+
+        totalSize += entry.size;
+        entries.push_back(std::move(entry));
+    }
+
+    if (totalSize > limit)
+    {
+        std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b)
+        {
+            return a.lastUse < b.lastUse;
+        });
+
+        // Removing a file another viewer has mapped is fine, its mapping
+        // stays valid
+        for (const Entry& entry : entries)
+        {
+            if (totalSize <= limit) break;
+            if (fs::remove(entry.path, error))
+                totalSize -= entry.size;
+        }
+    }
+
+    ::flock(lockFd, LOCK_UN);
+    ::close(lockFd);
+}
@@ -0,0 +1,41 @@
+#ifndef PIXEL_CACHE_HH
+#define PIXEL_CACHE_HH
+
+/*
+ * Disk cache of decoded pixels for images that are slow to parse (P3)
+ *
+ * Entries live under $XDG_CACHE_HOME/ppm-viewer/pixels. An entry is named
+ * after the path, size and mtime of the image and also records a hash of
+ * its content. The pixels start at a page boundary in the raw layout of
+ * ImageData::pixelData, so a hit is an mmap and a copy. Only full decodes
+ * through getImageData store entries, every P3 decode may use them.
+ *
+ * Entries are written to a temporary file and renamed into place, so any
+ * number of viewers can share the cache. A hit bumps the mtime of the
+ * entry and the least recently used entries are evicted once the cache
+ * grows past PPM_VIEWER_CACHE_SIZE MiB (2048 by default, 0 disables it).
+ */
+
+#include "PPMImage.hh"
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+namespace fs = std::filesystem;
+
+// content is the payload the pixels were decoded from, the header fields of
+// data have to be filled in already
+bool loadCachedPixels(const std::string& fileName, std::string_view content,
+                      ImageData& data);
+void storeCachedPixels(const std::string& fileName, std::string_view content,
+                       const ImageData& data);
+
+// $XDG_CACHE_HOME/ppm-viewer/<name>, falls back to ~/.cache
+fs::path getCacheDir(const std::string& name);
+
+// Unique name next to a cache entry to write it to before renaming it
+fs::path getCacheTempPath(const fs::path& entryPath);
+
+#endif // PIXEL_CACHE_HH
@@ -1,9 +1,17 @@
 #include "renderer.hh"
+#include "resampler.hh"
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <vector>
 #include <cstdint>
 
+#ifdef PPM_HEADLESS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
 const std::string s_shaderPath = "/shader/basic.shader";
 
 Renderer::Renderer(const ImageData& data): m_data(data)
@@ -25,22 +33,60 @@ void Renderer::run()
     renderLoop(shader);
 }
 
-void Renderer::renderLoop(Shader& shader)
+#ifdef PPM_HEADLESS
+bool Renderer::runHeadless(uint32_t frameCount, RenderStats& stats,
+                           std::vector<uint8_t>& pixels)
 {
-    while (!glfwWindowShouldClose(m_window))
+    m_headless = true;
+    m_stats = RenderStats();
+
+    if (!initEGL())
+    {
+        return false;
+    }
+
+    renderSetup();
     {
-        glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
+        Shader shader(s_shaderPath);
+
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t frame = 0; frame < frameCount; frame++)
+        {
+            drawFrame(shader);
+            glFinish();
+        }
+        auto end = std::chrono::steady_clock::now();
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, m_textureId);
+        if (frameCount > 0)
+        {
+            m_stats.frameTime = std::chrono::duration<double>(end - start).count()
+                                / frameCount;
+        }
+    }
+
+    pixels.resize(static_cast<size_t>(m_imageWidth) * m_imageHeight * 3);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, m_imageWidth, m_imageHeight, GL_RGB, GL_UNSIGNED_BYTE,
+                 pixels.data());
+
+    bool success = glGetError() == GL_NO_ERROR;
+    if (!success)
+    {
+        std::cerr << "OpenGL error while rendering headless!!!\n";
+    }
 
-        glBindVertexArray(m_VAO);
+    stats = m_stats;
+    terminateEGL();
 
-        shader.bind();
-        shader.setUniform1i("imageTexture", 0);
+    return success;
+}
+#endif
 
-        glDrawArrays(GL_TRIANGLES, 0, 6);
+void Renderer::renderLoop(Shader& shader)
+{
+    while (!glfwWindowShouldClose(m_window))
+    {
+        drawFrame(shader);
 
         glfwSwapBuffers(m_window);
         glfwPollEvents();
@@ -50,6 +96,22 @@ void Renderer::renderLoop(Shader& shader)
     glfwTerminate();
 }
 
+void Renderer::drawFrame(Shader& shader)
+{
+    glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_textureId);
+
+    glBindVertexArray(m_VAO);
+
+    shader.bind();
+    shader.setUniform1i("imageTexture", 0);
+
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+}
+
 bool Renderer::initGLFW()
 {
     if (!glfwInit())
@@ -62,6 +124,7 @@ bool Renderer::initGLFW()
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
+    fitToScreen();
     m_window = glfwCreateWindow(m_imageWidth, m_imageHeight, "ppm-viewer", nullptr, nullptr);
 
     if (!m_window)
@@ -86,6 +149,145 @@ bool Renderer::initGLFW()
     return true;
 }
 
+#ifdef PPM_HEADLESS
+bool Renderer::initEGL()
+{
+    EGLDisplay display = eglGetPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+                                               EGL_DEFAULT_DISPLAY, nullptr);
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr))
+    {
+        std::cerr << "Failed to initialize EGL!!!\n";
+        return false;
+    }
+    m_eglDisplay = display;
+
+    EGLint configAttribs[] =
+    {
+        // Surfaceless displays only offer pbuffer configs
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+
+    EGLConfig config;
+    EGLint configCount = 0;
+    if (!eglBindAPI(EGL_OPENGL_API)
+        || !eglChooseConfig(display, configAttribs, &config, 1, &configCount)
+        || configCount == 0)
+    {
+        std::cerr << "Failed to find an EGL config for OpenGL!!!\n";
+        terminateEGL();
+        return false;
+    }
+
+    EGLint contextAttribs[] =
+    {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 6,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+    if (context == EGL_NO_CONTEXT)
+    {
+        std::cerr << "Failed to create an OpenGL 4.6 context!!!\n";
+        terminateEGL();
+        return false;
+    }
+    m_eglContext = context;
+
+    // No surface at all, everything goes to the framebuffer below
+    if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)
+        || !gladLoadGLLoader((GLADloadproc)eglGetProcAddress))
+    {
+        std::cerr << "Failed to load GLAD!!!\n";
+        terminateEGL();
+        return false;
+    }
+
+    glGenRenderbuffers(1, &m_colorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_colorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, m_imageWidth, m_imageHeight);
+
+    glGenFramebuffers(1, &m_FBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_FBO);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER, m_colorBuffer);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        std::cerr << "Failed to create a " << m_imageWidth << "x" << m_imageHeight
+                  << " framebuffer!!!\n";
+        terminateEGL();
+        return false;
+    }
+
+    glViewport(0, 0, m_imageWidth, m_imageHeight);
+
+    return true;
+}
+
+void Renderer::terminateEGL()
+{
+    if (m_eglContext)
+    {
+        glDeleteFramebuffers(1, &m_FBO);
+        glDeleteRenderbuffers(1, &m_colorBuffer);
+        glDeleteTextures(1, &m_textureId);
+        glDeleteBuffers(1, &m_VBO);
+        glDeleteVertexArrays(1, &m_VAO);
+
+        eglMakeCurrent(m_eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(m_eglDisplay, m_eglContext);
+        m_eglContext = nullptr;
+    }
+
+    if (m_eglDisplay)
+    {
+        eglTerminate(m_eglDisplay);
+        m_eglDisplay = nullptr;
+    }
+}
+#endif
+
+// Images larger than the screen are shrunk on the CPU, so the texture only
+// holds what can actually be displayed
+void Renderer::fitToScreen()
+{
+    GLFWmonitor* monitor = glfwGetPrimaryMonitor();
+    if (!monitor) return;
+
+    int areaX, areaY, areaWidth, areaHeight;
+    glfwGetMonitorWorkarea(monitor, &areaX, &areaY, &areaWidth, &areaHeight);
+    if (areaWidth <= 0 || areaHeight <= 0) return;
+
+    if (m_imageWidth <= static_cast<unsigned int>(areaWidth)
+        && m_imageHeight <= static_cast<unsigned int>(areaHeight))
+    {
+        return;
+    }
+
+    double scale = std::min(static_cast<double>(areaWidth) / m_imageWidth,
+                            static_cast<double>(areaHeight) / m_imageHeight);
+    uint32_t width = std::max(1u, static_cast<uint32_t>(m_imageWidth * scale));
+    uint32_t height = std::max(1u, static_cast<uint32_t>(m_imageHeight * scale));
+
+    // On failure the full size image is shown instead
+    ImageData resampled;
+    resampleImage(m_data, width, height, ResampleFilter::Lanczos3, resampled);
+    if (!resampled.isValid())
+    {
+        std::cerr << "Failed to fit the image to the screen: "
+                  << resampled.exceptionMsg << '\n';
+        return;
+    }
+
+    m_data = std::move(resampled);
+    m_imageWidth = m_data.imageWidth;
+    m_imageHeight = m_data.imageHeight;
+}
+
 void Renderer::renderSetup()
 {
     float vertices[] =
@@ -129,6 +331,14 @@ void Renderer::createTexture()
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
+    // Only the headless benchmark waits for the GPU, a window never does
+    auto now = [this]()
+    {
+        if (m_headless) glFinish();
+        return std::chrono::steady_clock::now();
+    };
+    auto uploadStart = now();
+
     uint32_t maxColorValue = m_data.maxColorValue;
 
     if (maxColorValue <= 255) {
@@ -150,7 +360,12 @@ void Renderer::createTexture()
                      GL_RGB, GL_UNSIGNED_SHORT, m_data.pixelData.data());
     }
 
+    auto mipmapStart = now();
     glGenerateMipmap(GL_TEXTURE_2D);
+    auto mipmapEnd = now();
+
+    m_stats.uploadTime = std::chrono::duration<double>(mipmapStart - uploadStart).count();
+    m_stats.mipmapTime = std::chrono::duration<double>(mipmapEnd - mipmapStart).count();
 }
 
 void Renderer::updateWindowSize(GLFWwindow* window, int width, int height)
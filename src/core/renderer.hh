@@ -7,6 +7,17 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
+#include <vector>
+#include <cstdint>
+
+// Timings of the headless pipeline in seconds
+struct RenderStats
+{
+    double uploadTime = 0.0;
+    double mipmapTime = 0.0;
+    double frameTime = 0.0; // average over all frames
+};
+
 class Renderer
 {
 public:
@@ -14,16 +25,41 @@ public:
     ~Renderer();
 
     void run();
+#ifdef PPM_HEADLESS
+    // Renders into an offscreen framebuffer of the image size without a
+    // window (EGL surfaceless) and reads the last frame back as RGB8,
+    // bottom row first
+    bool runHeadless(uint32_t frameCount, RenderStats& stats,
+                     std::vector<uint8_t>& pixels);
+#endif
 private:
     bool initGLFW();
+    void fitToScreen();
     void renderSetup();
     void createTexture();
     void renderLoop(Shader& shader);
+    void drawFrame(Shader& shader);
     static void updateWindowSize(GLFWwindow* window, int width, int height);
+#ifdef PPM_HEADLESS
+    bool initEGL();
+    void terminateEGL();
+#endif
 
 private:
     GLFWwindow* m_window;
 
+    // Headless mode waits for the GPU to finish so the stats mean something
+    bool m_headless = false;
+    RenderStats m_stats;
+
+    // EGLDisplay and EGLContext, kept opaque to not leak EGL into the header
+    void* m_eglDisplay = nullptr;
+    void* m_eglContext = nullptr;
+
+    // Offscreen framebuffer used instead of a window
+    unsigned int m_FBO = 0;
+    unsigned int m_colorBuffer = 0;
+
     // Hardcoded for now
     // Later, takes the image width and height
     unsigned int m_imageWidth = 800;
@@ -33,11 +69,11 @@ private:
     ImageData m_data;
 
     // Vertex Buffer
-    unsigned int m_VAO;
-    unsigned int m_VBO;
+    unsigned int m_VAO = 0;
+    unsigned int m_VBO = 0;
 
     // Texture ID
-    unsigned int m_textureId;
+    unsigned int m_textureId = 0;
 };
 
 #endif // RENDERER_HH
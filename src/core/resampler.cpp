@@ -0,0 +1,394 @@
+#include "resampler.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PPM_HAS_AVX2_PATH
+#endif
+
+constexpr float s_pi = 3.14159265358979f;
+
+// Weights of one axis. Every output coordinate uses the same number of taps,
+// starting at first[i], so the inner loops have a fixed length
+struct FilterWeights
+{
+    uint32_t taps;
+    std::vector<int32_t> first;
+    std::vector<float> weights; // taps per output coordinate
+};
+
+//------------------------------------------------------------------------------
+float filterSupport(ResampleFilter filter);
+float filterValue(ResampleFilter filter, float x);
+FilterWeights computeWeights(uint32_t srcSize, uint32_t dstSize, ResampleFilter filter);
+
+void resampleRows(const ImageData& src, const FilterWeights& weights,
+                  uint32_t firstRow, uint32_t lastRow, uint32_t dstWidth,
+                  float* dst);
+void resampleColumns(const float* src, const FilterWeights& weights,
+                     uint32_t firstRow, uint32_t lastRow, uint32_t dstWidth,
+                     float maxValue, uint16_t* dst);
+
+void accumulateRow(float* acc, const float* src, float weight, size_t count);
+#ifdef PPM_HAS_AVX2_PATH
+bool cpuHasAVX2();
+__attribute__((target("avx2,fma")))
+void resampleRowsAVX2(const ImageData& src, const FilterWeights& weights,
+                      uint32_t firstRow, uint32_t lastRow, uint32_t dstWidth,
+                      float* dst);
+__attribute__((target("avx2,fma")))
+void accumulateRowAVX2(float* acc, const float* src, float weight, size_t count);
+#endif
+
+template <typename Func>
+void forEachBand(uint32_t rowCount, Func func);
+
+//------------------------------------------------------------------------------
+void resampleImage(const ImageData& src, uint32_t width, uint32_t height,
+                   ResampleFilter filter, ImageData& dst)
+{
+    if (width == 0 || height == 0 || src.pixelData.size()
+        != static_cast<size_t>(src.imageWidth) * src.imageHeight * 3)
+    {
+        dst.exceptionMsg = "Cannot resample to " + std::to_string(width)
+                           + "x" + std::to_string(height);
+        return;
+    }
+
+    const FilterWeights horizontal = computeWeights(src.imageWidth, width, filter);
+    const FilterWeights vertical = computeWeights(src.imageHeight, height, filter);
+    const float maxValue = src.maxColorValue <= 255 ? 255.0f : 65535.0f;
+
+    // Horizontal pass over all source rows
+    std::vector<float> temp(static_cast<size_t>(width) * 3 * src.imageHeight);
+    forEachBand(src.imageHeight, [&](uint32_t firstRow, uint32_t lastRow)
+    {
+        resampleRows(src, horizontal, firstRow, lastRow, width, temp.data());
+    });
+
+    // Vertical pass into the result
+    std::vector<uint16_t> pixelData(static_cast<size_t>(width) * height * 3);
+    forEachBand(height, [&](uint32_t firstRow, uint32_t lastRow)
+    {
+        resampleColumns(temp.data(), vertical, firstRow, lastRow, width,
+                        maxValue, pixelData.data());
+    });
+
+    // src is not touched anymore, so it may alias dst
+    dst.maxColorValue = src.maxColorValue;
+    dst.imageWidth = width;
+    dst.imageHeight = height;
+    dst.pixelData = std::move(pixelData);
+}
+
+//------------------------------------------------------------------------------
+float filterSupport(ResampleFilter filter)
+{
+    switch (filter)
+    {
+        case ResampleFilter::Box:      return 0.5f;
+        case ResampleFilter::Mitchell: return 2.0f;
+        case ResampleFilter::Lanczos3: return 3.0f;
+    }
+
+    return 0.5f;
+}
+
+float filterValue(ResampleFilter filter, float x)
+{
+    x = std::fabs(x);
+
+    switch (filter)
+    {
+        case ResampleFilter::Box:
+            return x <= 0.5f ? 1.0f : 0.0f;
+
+        case ResampleFilter::Mitchell:
+        {
+            // B = C = 1/3
+            constexpr float B = 1.0f / 3.0f;
+            constexpr float C = 1.0f / 3.0f;
+            if (x < 1.0f)
+                return ((12 - 9 * B - 6 * C) * x * x * x
+                        + (-18 + 12 * B + 6 * C) * x * x
+                        + (6 - 2 * B)) / 6.0f;
+            if (x < 2.0f)
+                return ((-B - 6 * C) * x * x * x + (6 * B + 30 * C) * x * x
+                        + (-12 * B - 48 * C) * x + (8 * B + 24 * C)) / 6.0f;
+            return 0.0f;
+        }
+
+        case ResampleFilter::Lanczos3:
+        {
+            if (x < 1e-6f) return 1.0f;
+            if (x >= 3.0f) return 0.0f;
+            const float pix = s_pi * x;
+            return 3.0f * std::sin(pix) * std::sin(pix / 3.0f) / (pix * pix);
+        }
+    }
+
+    return 0.0f;
+}
+
+FilterWeights computeWeights(uint32_t srcSize, uint32_t dstSize, ResampleFilter filter)
+{
+    // When shrinking the filter is stretched so that it covers every source
+    // pixel that falls into an output pixel
+    const float scale = static_cast<float>(srcSize) / dstSize;
+    const float filterScale = std::max(scale, 1.0f);
+    const float support = filterSupport(filter) * filterScale;
+
+    FilterWeights result;
+    result.taps = std::min<uint32_t>(srcSize, static_cast<uint32_t>(std::ceil(support)) * 2 + 1);
+    result.first.resize(dstSize);
+    result.weights.assign(static_cast<size_t>(dstSize) * result.taps, 0.0f);
+
+    for (uint32_t out = 0; out < dstSize; out++)
+    {
+        const float center = (out + 0.5f) * scale;
+        int32_t first = static_cast<int32_t>(std::floor(center - support + 0.5f));
+        first = std::clamp<int32_t>(first, 0, srcSize - result.taps);
+        result.first[out] = first;
+
+        float* weights = result.weights.data() + static_cast<size_t>(out) * result.taps;
+        float sum = 0.0f;
+        for (uint32_t tap = 0; tap < result.taps; tap++)
+        {
+            weights[tap] = filterValue(filter, (first + tap + 0.5f - center) / filterScale);
+            sum += weights[tap];
+        }
+
+        // Normalize, a box narrower than a pixel falls back to the nearest one
+        if (sum != 0.0f)
+        {
+            for (uint32_t tap = 0; tap < result.taps; tap++)
+                weights[tap] /= sum;
+        }
+        else
+        {
+            int32_t nearest = std::clamp<int32_t>(static_cast<int32_t>(center), 0, srcSize - 1);
+            weights[std::clamp<int32_t>(nearest - first, 0, result.taps - 1)] = 1.0f;
+        }
+    }
+
+    return result;
+}
+
+//------------------------------------------------------------------------------
+void resampleRows(const ImageData& src, const FilterWeights& weights,
+                  uint32_t firstRow, uint32_t lastRow, uint32_t dstWidth,
+                  float* dst)
+{
+#ifdef PPM_HAS_AVX2_PATH
+    if (cpuHasAVX2())
+    {
+        resampleRowsAVX2(src, weights, firstRow, lastRow, dstWidth, dst);
+        return;
+    }
+#endif
+
+    const size_t srcStride = static_cast<size_t>(src.imageWidth) * 3;
+    const size_t dstStride = static_cast<size_t>(dstWidth) * 3;
+
+    for (uint32_t row = firstRow; row < lastRow; row++)
+    {
+        const uint16_t* srcRow = src.pixelData.data() + row * srcStride;
+        float* dstRow = dst + row * dstStride;
+
+        for (uint32_t x = 0; x < dstWidth; x++)
+        {
+            const uint16_t* pixel = srcRow + static_cast<size_t>(weights.first[x]) * 3;
+            const float* weight = weights.weights.data() + static_cast<size_t>(x) * weights.taps;
+
+            float r = 0.0f, g = 0.0f, b = 0.0f;
+            for (uint32_t tap = 0; tap < weights.taps; tap++)
+            {
+                r += weight[tap] * pixel[0];
+                g += weight[tap] * pixel[1];
+                b += weight[tap] * pixel[2];
+                pixel += 3;
+            }
+
+            dstRow[x * 3] = r;
+            dstRow[x * 3 + 1] = g;
+            dstRow[x * 3 + 2] = b;
+        }
+    }
+}
+
+void resampleColumns(const float* src, const FilterWeights& weights,
+                     uint32_t firstRow, uint32_t lastRow, uint32_t dstWidth,
+                     float maxValue, uint16_t* dst)
+{
+    const size_t stride = static_cast<size_t>(dstWidth) * 3;
+    std::vector<float> acc(stride);
+
+    for (uint32_t row = firstRow; row < lastRow; row++)
+    {
+        std::fill(acc.begin(), acc.end(), 0.0f);
+
+        const float* weight = weights.weights.data() + static_cast<size_t>(row) * weights.taps;
+        for (uint32_t tap = 0; tap < weights.taps; tap++)
+        {
+            if (weight[tap] == 0.0f) continue;
+
+            const float* srcRow = src + (weights.first[row] + tap) * stride;
+            accumulateRow(acc.data(), srcRow, weight[tap], stride);
+        }
+
+        // Lanczos and Mitchell overshoot near edges
+        uint16_t* dstRow = dst + row * stride;
+        for (size_t it = 0; it < stride; it++)
+        {
+            dstRow[it] = static_cast<uint16_t>(std::clamp(acc[it] + 0.5f, 0.0f, maxValue));
+        }
+    }
+}
+
+// acc += weight * src
+void accumulateRow(float* acc, const float* src, float weight, size_t count)
+{
+#ifdef PPM_HAS_AVX2_PATH
+    if (cpuHasAVX2())
+    {
+        accumulateRowAVX2(acc, src, weight, count);
+        return;
+    }
+#endif
+
+    for (size_t it = 0; it < count; it++)
+    {
+        acc[it] += weight * src[it];
+    }
+}
+
+#ifdef PPM_HAS_AVX2_PATH
+bool cpuHasAVX2()
+{
+    static const bool hasAVX2 = __builtin_cpu_supports("avx2")
+                                && __builtin_cpu_supports("fma");
+    return hasAVX2;
+}
+
+// Eight interleaved output samples at a time. Every lane gathers the source
+// sample of its own pixel and channel for each tap, so no horizontal sums
+// are needed
+__attribute__((target("avx2,fma")))
+void resampleRowsAVX2(const ImageData& src, const FilterWeights& weights,
+                      uint32_t firstRow, uint32_t lastRow, uint32_t dstWidth,
+                      float* dst)
+{
+    const size_t srcStride = static_cast<size_t>(src.imageWidth) * 3;
+    const size_t dstStride = static_cast<size_t>(dstWidth) * 3;
+    const size_t blockCount = (dstStride + 7) / 8;
+    const uint32_t taps = weights.taps;
+
+    // Per lane the source offset of the first tap, and the weights of every
+    // tap lane by lane. Lanes past the end of the row read sample 0 with a
+    // weight of 0
+    std::vector<int32_t> offsets(blockCount * 8, 0);
+    std::vector<float> laneWeights(blockCount * taps * 8, 0.0f);
+    for (size_t it = 0; it < dstStride; it++)
+    {
+        const size_t x = it / 3;
+        offsets[it] = weights.first[x] * 3 + it % 3;
+        for (uint32_t tap = 0; tap < taps; tap++)
+        {
+            laneWeights[(it / 8 * taps + tap) * 8 + it % 8] = weights.weights[x * taps + tap];
+        }
+    }
+
+    const __m256i step = _mm256_set1_epi32(3);
+    std::vector<float> srcRow(srcStride);
+
+    for (uint32_t row = firstRow; row < lastRow; row++)
+    {
+        const uint16_t* samples = src.pixelData.data() + row * srcStride;
+        size_t it = 0;
+        for (; it + 8 <= srcStride; it += 8)
+        {
+            __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + it));
+            _mm256_storeu_ps(srcRow.data() + it,
+                             _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(packed)));
+        }
+        for (; it < srcStride; it++)
+        {
+            srcRow[it] = samples[it];
+        }
+
+        float* dstRow = dst + row * dstStride;
+        for (size_t block = 0; block < blockCount; block++)
+        {
+            __m256i index = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(offsets.data() + block * 8));
+            const float* weight = laneWeights.data() + block * taps * 8;
+
+            __m256 sum = _mm256_setzero_ps();
+            for (uint32_t tap = 0; tap < taps; tap++)
+            {
+                __m256 value = _mm256_i32gather_ps(srcRow.data(), index, 4);
+                sum = _mm256_fmadd_ps(_mm256_loadu_ps(weight + tap * 8), value, sum);
+                index = _mm256_add_epi32(index, step);
+            }
+
+            if (block * 8 + 8 <= dstStride)
+            {
+                _mm256_storeu_ps(dstRow + block * 8, sum);
+            }
+            else
+            {
+                float lanes[8];
+                _mm256_storeu_ps(lanes, sum);
+                std::copy(lanes, lanes + (dstStride - block * 8), dstRow + block * 8);
+            }
+        }
+    }
+}
+
+__attribute__((target("avx2,fma")))
+void accumulateRowAVX2(float* acc, const float* src, float weight, size_t count)
+{
+    const __m256 factor = _mm256_set1_ps(weight);
+
+    size_t it = 0;
+    for (; it + 8 <= count; it += 8)
+    {
+        __m256 sum = _mm256_loadu_ps(acc + it);
+        sum = _mm256_fmadd_ps(_mm256_loadu_ps(src + it), factor, sum);
+        _mm256_storeu_ps(acc + it, sum);
+    }
+
+    for (; it < count; it++)
+    {
+        acc[it] += weight * src[it];
+    }
+}
+#endif
+
+// Splits the rows into one band per thread
+template <typename Func>
+void forEachBand(uint32_t rowCount, Func func)
+{
+    const uint32_t bandCount = std::min<uint32_t>(
+        rowCount, std::max(1u, std::thread::hardware_concurrency()));
+
+    std::vector<std::thread> threads;
+    for (uint32_t band = 1; band < bandCount; band++)
+    {
+        threads.emplace_back(func,
+                             static_cast<uint32_t>(static_cast<uint64_t>(rowCount) * band / bandCount),
+                             static_cast<uint32_t>(static_cast<uint64_t>(rowCount) * (band + 1) / bandCount));
+    }
+
+    // The calling thread takes the first band
+    func(0, rowCount / bandCount);
+
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef RESAMPLER_HH
+#define RESAMPLER_HH
+
+/*
+ * Separable CPU resampler
+ *
+ * The image is filtered horizontally into a float buffer and then
+ * vertically into the result. The filter weights of every output row and
+ * column are computed once up front, both passes are split into row bands
+ * that run on their own threads. Both passes use AVX2 when the CPU has
+ * it.
+ *
+ * Works on both 8 and 16-bit ImageData, the result keeps the depth.
+ */
+
+#include "PPMImage.hh"
+
+#include <cstdint>
+
+enum class ResampleFilter
+{
+    Box = 0,
+    Mitchell,
+    Lanczos3
+};
+
+// src and dst may be the same object
+void resampleImage(const ImageData& src, uint32_t width, uint32_t height,
+                   ResampleFilter filter, ImageData& dst);
+
+#endif // RESAMPLER_HH
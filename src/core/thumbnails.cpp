@@ -0,0 +1,135 @@
+#include "thumbnails.hh"
+#include "pixelCache.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <cstdio>
+
+#include <sys/stat.h>
+
+//------------------------------------------------------------------------------
+fs::path getThumbnailPath(const fs::path& cacheDir, const std::string& fileName,
+                          uint32_t maxSize);
+void loadThumbnail(const fs::path& cacheDir, const std::string& fileName,
+                   uint32_t maxSize, ImageData& thumbnail);
+uint64_t hashString(const std::string& str);
+
+//------------------------------------------------------------------------------
+std::vector<std::string> listPPMFiles(const std::string& directory)
+{
+    std::vector<std::string> files;
+
+    std::error_code error;
+    for (const fs::directory_entry& entry : fs::directory_iterator(directory, error))
+    {
+        if (entry.is_regular_file(error) && hasPPMextension(entry.path().string()))
+        {
+            files.push_back(entry.path().string());
+        }
+    }
+
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+void loadThumbnails(const std::vector<std::string>& files, uint32_t maxSize,
+                    std::vector<ImageData>& thumbnails)
+{
+    thumbnails.clear();
+    thumbnails.resize(files.size());
+
+    fs::path cacheDir = getCacheDir("thumbnails");
+
+    // Workers pick the next file until none are left
+    std::atomic<size_t> nextFile = 0;
+    auto worker = [&]()
+    {
+        for (size_t it = nextFile++; it < files.size(); it = nextFile++)
+        {
+            loadThumbnail(cacheDir, files[it], maxSize, thumbnails[it]);
+        }
+    };
+
+    size_t threadCount = std::min<size_t>(files.size(),
+                                          std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::thread> threads;
+    for (size_t it = 0; it < threadCount; it++)
+    {
+        threads.emplace_back(worker);
+    }
+
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+//------------------------------------------------------------------------------
+void loadThumbnail(const fs::path& cacheDir, const std::string& fileName,
+                   uint32_t maxSize, ImageData& thumbnail)
+{
+    fs::path cachePath = getThumbnailPath(cacheDir, fileName, maxSize);
+
+    if (!cachePath.empty() && fs::exists(cachePath))
+    {
+        getImageData(cachePath.string(), thumbnail);
+        if (thumbnail.isValid()) return;
+
+        // Broken cache entry, decode the image again
+        thumbnail = ImageData();
+    }
+
+    getImageThumbnail(fileName, maxSize, thumbnail);
+    if (!thumbnail.isValid() || cachePath.empty()) return;
+
+    // Other viewers may share the cache, so the entry only appears once it
+    // is complete
+    std::error_code error;
+    fs::create_directories(cacheDir, error);
+    fs::path tempPath = getCacheTempPath(cachePath);
+
+    ImageData entry = thumbnail;
+    writeImageData(tempPath.string(), entry, PPMType::P6);
+    if (entry.isValid())
+        fs::rename(tempPath, cachePath, error);
+    else
+        fs::remove(tempPath, error);
+}
+
+// Empty if the image can't be stat'ed
+fs::path getThumbnailPath(const fs::path& cacheDir, const std::string& fileName,
+                          uint32_t maxSize)
+{
+    std::error_code error;
+    fs::path canonicalPath = fs::canonical(fileName, error);
+    if (error) return fs::path();
+
+    struct stat info;
+    if (::stat(canonicalPath.c_str(), &info) != 0) return fs::path();
+
+    std::string key = canonicalPath.string() + '\0'
+                      + std::to_string(info.st_size) + '\0'
+                      + std::to_string(info.st_mtim.tv_sec) + "."
+                      + std::to_string(info.st_mtim.tv_nsec) + '\0'
+                      + std::to_string(maxSize);
+
+    char name[17];
+    std::snprintf(name, sizeof(name), "%016llx",
+                  static_cast<unsigned long long>(hashString(key)));
+
+    return cacheDir / (std::string(name) + ".ppm");
+}
+
+// FNV-1a, only used to name cache entries
+uint64_t hashString(const std::string& str)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (unsigned char c : str)
+    {
+        hash ^= c;
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
@@ -0,0 +1,29 @@
+#ifndef THUMBNAILS_HH
+#define THUMBNAILS_HH
+
+/*
+ * Thumbnails for the contact sheet
+ *
+ * Thumbnails are decoded in parallel through getImageThumbnail() and kept
+ * on disk as small P6 files under $XDG_CACHE_HOME/ppm-viewer/thumbnails.
+ * A cache entry is named after a hash of the path, size and mtime of the
+ * image, so a changed image simply misses the cache.
+ */
+
+#include "PPMImage.hh"
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace fs = std::filesystem;
+
+// Sorted list of the .ppm files in the directory
+std::vector<std::string> listPPMFiles(const std::string& directory);
+
+// thumbnails[i] belongs to files[i], failed ones carry their exceptionMsg
+void loadThumbnails(const std::vector<std::string>& files, uint32_t maxSize,
+                    std::vector<ImageData>& thumbnails);
+
+#endif // THUMBNAILS_HH
@@ -0,0 +1,40 @@
+#shader vertex
+#version 460
+layout (location = 0) in vec2 aCorner;   // unit quad, y pointing down
+layout (location = 1) in vec4 aTexRect;  // u0 v0 u1 v1 in the atlas layer
+layout (location = 2) in float aLayer;
+layout (location = 3) in vec2 aExtent;   // thumbnail size in pixels
+
+uniform vec2 viewportSize;
+uniform float cellSize;
+uniform int columns;
+uniform float scrollOffset;
+
+out vec3 TexCoords;
+
+void main()
+{
+    // The cell follows from the instance, so resizing only changes uniforms
+    int index = gl_BaseInstance + gl_InstanceID;
+    vec2 cell = vec2(index % columns, index / columns);
+
+    vec2 origin = cell * cellSize + (cellSize - aExtent) * 0.5;
+    vec2 pixel = origin + aCorner * aExtent - vec2(0.0, scrollOffset);
+
+    vec2 ndc = pixel / viewportSize * 2.0 - 1.0;
+    gl_Position = vec4(ndc.x, -ndc.y, 0.0, 1.0);
+    TexCoords = vec3(mix(aTexRect.xy, aTexRect.zw, aCorner), aLayer);
+}
+
+#shader fragment
+#version 460
+in vec3 TexCoords;
+
+out vec4 FragColor;
+
+uniform sampler2DArray atlas;
+
+void main()
+{
+    FragColor = texture(atlas, TexCoords);
+}